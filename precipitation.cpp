@@ -1,339 +1,1808 @@
 #include "precipitation.h"
+#include "precipitation_batcher.h"
+#include "os/os.h"
 
-void Precipitation::calculate_particle_cutoff_point(Precipitation::Particle *p_particle, const AABB &p_box, const Vector3 &p_wind_velocity) {
-	if (using_collision == true) {
-		Vector3 velocity = p_wind_velocity / p_particle->mass - Vector3(0, p_particle->velocity, 0);
+// Quality lost per second while over the frame budget, and regained per second while comfortably under it.
+static const float GOVERNOR_DEGRADE_RATE = 0.5;
+static const float GOVERNOR_RECOVER_RATE = 0.1;
+// Below this fraction of the budget the quality recovers; between it and the budget it holds.
+static const float GOVERNOR_RECOVER_THRESHOLD = 0.75;
+static const float GOVERNOR_MIN_QUALITY = 0.1;
+
+template <int COLLISION>
+void Precipitation::_calculate_cutoff_point(uint32_t p_index, const Vector3 &p_wind_velocity) {
+	uint8_t &flags = _get_particle_flags()[p_index];
+
+	if (precipitation_feature_enabled<COLLISION>(using_collision)) {
+		Vector3 position = _get_particle_position(p_index);
+		Vector3 wind = using_wind_samples ? p_wind_velocity + Vector3(wind_sample_x_write[p_index], wind_sample_y_write[p_index], wind_sample_z_write[p_index]) : p_wind_velocity;
+		float inv_mass = using_compact_storage ? compact_particles.get_inv_mass(p_index) : particles.inv_mass[p_index];
+		float speed = using_compact_storage ? compact_particles.get_speed(p_index) : particles.velocity[p_index];
+		Vector3 velocity = wind * inv_mass - Vector3(0, speed, 0);
 		velocity = velocity.normalized();
-		
-		Vector3 from = p_particle->position;
-		Vector3 to = p_particle->position + (velocity * 100);
 
-		Set<RID> exclude;
+		float height = PrecipitationOcclusionCache::EMPTY_HEIGHT;
+		bool mapped = occlusion_map.is_valid() && occlusion_map->get_cutoff_height(position, velocity, height);
+		if (mapped || occlusion_cache.lookup(position, velocity, height)) {
+			_set_particle_hit_height(p_index, height);
+
+			if (position.y > height)
+				flags |= PrecipitationParticlePool::FLAG_VALID;
+			else
+				flags &= ~PrecipitationParticlePool::FLAG_VALID;
+			flags &= ~PrecipitationParticlePool::FLAG_PENDING_CUTOFF;
+		}
+		else {
+			// The column is still waiting for its raycast; stop the drop at the provisional height until it resolves.
+			_set_particle_hit_height(p_index, height);
+
+			if (position.y > height)
+				flags |= PrecipitationParticlePool::FLAG_VALID;
+			else
+				flags &= ~PrecipitationParticlePool::FLAG_VALID;
+			if (!(flags & PrecipitationParticlePool::FLAG_PENDING_CUTOFF)) {
+				flags |= PrecipitationParticlePool::FLAG_PENDING_CUTOFF;
+				pending_cutoffs.push_back(p_index);
+			}
+		}
+	}
+	else {
+		_set_particle_hit_height(p_index, PrecipitationOcclusionCache::EMPTY_HEIGHT);
+		flags |= PrecipitationParticlePool::FLAG_VALID;
+		flags &= ~PrecipitationParticlePool::FLAG_PENDING_CUTOFF;
+	}
+}
+
+template <int COLLISION>
+void Precipitation::_calculate_cutoff_points(const uint32_t *p_indices, uint32_t p_count) {
+	for (uint32_t i = 0; i < p_count; i++) {
+		_calculate_cutoff_point<COLLISION>(p_indices[i], wind_velocity);
+	}
+}
+
+void Precipitation::_dispatch_cutoff_points(const uint32_t *p_indices, uint32_t p_count) {
+	if (!using_specialized_kernels)
+		_calculate_cutoff_points<PRECIPITATION_FEATURE_DYNAMIC>(p_indices, p_count);
+	else if (using_collision)
+		_calculate_cutoff_points<PRECIPITATION_FEATURE_ON>(p_indices, p_count);
+	else
+		_calculate_cutoff_points<PRECIPITATION_FEATURE_OFF>(p_indices, p_count);
+}
+
+void Precipitation::calculate_particle_cutoff_point(uint32_t p_index, const AABB &p_box, const Vector3 &p_wind_velocity) {
+	_calculate_cutoff_point<PRECIPITATION_FEATURE_DYNAMIC>(p_index, p_wind_velocity);
+}
+
+void Precipitation::_update_occlusion_cache() {
+	float mean_inv_mass = 2.0 / (min_mass + max_mass);
+	float mean_speed = (min_speed + max_speed) * 0.5;
+	Vector3 direction = wind_velocity * mean_inv_mass - Vector3(0, mean_speed, 0);
+	direction.y = MIN(direction.y, -CMP_EPSILON);
+	direction.normalize();
+
+	// Snap the reference plane to whole box heights so small vertical camera moves keep the cache. The box
+	// bottom is never more than two box heights below the plane, so size the grid and rays for that and let
+	// only a step of the plane, the direction or the cell size reset the cache.
+	float box_top = visibility_box.pos.y + visibility_box.size.y * 0.5;
+	float reference_height = visibility_box.size.y > 0 ? Math::ceil(box_top / visibility_box.size.y) * visibility_box.size.y : box_top;
+	float fall_height = visibility_box.size.y * 2;
+
+	float shear = Vector2(direction.x, direction.z).length() / -direction.y * fall_height;
+	int resolution = (int)Math::ceil((visibility_box.size.x + shear) / occlusion_cell_size) + 2;
+	resolution = MIN(resolution, 1024);
+
+	float ray_length = fall_height / MAX(-direction.y, 0.1) + 100;
+
+	occlusion_cache.configure(occlusion_cell_size, resolution, direction, reference_height, ray_length);
+
+	Vector3 box_min = visibility_box.pos - visibility_box.size * 0.5;
+	AABB top = AABB(Vector3(box_min.x - shear, reference_height, box_min.z - shear), Vector3(visibility_box.size.x + shear * 2, 0, visibility_box.size.z + shear * 2));
+	occlusion_bounds = top.merge(AABB(top.pos + direction * ray_length, top.size));
+}
+
+void Precipitation::_resolve_pending_cutoffs() {
+	if (pending_cutoffs.empty())
+		return;
+
+	uint32_t count = _get_particle_count();
+	uint8_t *flags = _get_particle_flags();
+	Vector<uint32_t> retry = pending_cutoffs;
+	pending_cutoffs.clear();
+
+	for (int i = 0; i < retry.size(); i++) {
+		uint32_t index = retry[i];
+		if (index >= count || !(flags[index] & PrecipitationParticlePool::FLAG_PENDING_CUTOFF))
+			continue;
+
+		flags[index] &= ~PrecipitationParticlePool::FLAG_PENDING_CUTOFF;
+		calculate_particle_cutoff_point(index, visibility_box, wind_velocity);
+	}
+}
+
+void Precipitation::spawn_particles(uint32_t p_from, uint32_t p_to) {
+	uint32_t count = p_to - p_from;
+	uint32_t window_size = _get_window_size();
+	uint32_t first = random.get_counter();
+	float half_width = box_size.x * 0.5;
+	float half_height = box_size.y * 0.5;
+
+	// Each attribute is generated for a whole window at once, straight into the pool. Every window seeks to
+	// its part of each attribute's run, so the drops come out the same whatever the window size.
+	for (uint32_t base = p_from, end; base < p_to; base = end) {
+		end = base + MIN(window_size, p_to - base);
+		uint32_t n = end - base;
+		uint32_t offset = first + (base - p_from);
+		PrecipitationParticlePool view;
+		PrecipitationParticlePool &window = _open_window(view, base, end, 0);
+
+		random.seek(offset);
+		random.fill(window.velocity, n, min_speed, max_speed);
+		random.seek(offset + count);
+		random.fill(window.position_x, n, visibility_box.pos.x - half_width, visibility_box.pos.x + half_width);
+		random.seek(offset + count * 2);
+		random.fill(window.position_y, n, visibility_box.pos.y - half_height, visibility_box.pos.y + half_height);
+		random.seek(offset + count * 3);
+		random.fill(window.position_z, n, visibility_box.pos.z - half_width, visibility_box.pos.z + half_width);
+		random.seek(offset + count * 4);
+		random.fill_reciprocal(window.inv_mass, n, min_mass, max_mass);
+		random.seek(offset + count * 5);
+		random.fill_index(window.tex_coord_index, n, drops_per_texture * drops_per_texture);
+
+		for (uint32_t i = 0; i < n; i++) {
+			window.flags[i] = PrecipitationParticlePool::FLAG_VALID;
+			window.hit_height[i] = PrecipitationOcclusionCache::EMPTY_HEIGHT;
+		}
+
+		if (using_compact_storage)
+			compact_particles.encode(window, base, end, compact_frame);
+	}
+
+	random.seek(first + count * 6);
+}
+
+void Precipitation::respawn_particles(const uint32_t *p_indices, uint32_t p_count) {
+	if (p_count == 0)
+		return;
+
+	float half_width = box_size.x * 0.5;
+
+	// Generated in one batch, then scattered; the drops keep the height they wrapped to.
+	spawn_values.resize(p_count * 4);
+	spawn_tex_coords.resize(p_count);
+	float *speed = spawn_values.ptr();
+	float *x = speed + p_count;
+	float *z = x + p_count;
+	float *inv_mass = z + p_count;
+	uint32_t *tex_coord_index = spawn_tex_coords.ptr();
+
+	random.fill(speed, p_count, min_speed, max_speed);
+	random.fill(x, p_count, visibility_box.pos.x - half_width, visibility_box.pos.x + half_width);
+	random.fill(z, p_count, visibility_box.pos.z - half_width, visibility_box.pos.z + half_width);
+	random.fill_reciprocal(inv_mass, p_count, min_mass, max_mass);
+	random.fill_index(tex_coord_index, p_count, drops_per_texture * drops_per_texture);
+
+	uint8_t *flags = _get_particle_flags();
+	for (uint32_t i = 0; i < p_count; i++) {
+		uint32_t index = p_indices[i];
+		if (using_compact_storage) {
+			float y = compact_particles.get_position(index, compact_frame).y;
+			compact_particles.set_speed(index, speed[i]);
+			compact_particles.set_position(index, Vector3(x[i], y, z[i]), compact_frame);
+			compact_particles.set_inv_mass(index, inv_mass[i]);
+			compact_particles.tex_coord_index[index] = tex_coord_index[i];
+		}
+		else {
+			particles.velocity[index] = speed[i];
+			particles.position_x[index] = x[i];
+			particles.position_z[index] = z[i];
+			particles.inv_mass[index] = inv_mass[i];
+			particles.tex_coord_index[index] = tex_coord_index[i];
+		}
+
+		flags[index] = (flags[index] & ~PrecipitationParticlePool::FLAG_RESPAWN) | PrecipitationParticlePool::FLAG_VALID;
+	}
+}
+
+void Precipitation::empty_particles() {
+	particles.clear();
+	compact_particles.clear();
+	_update_wind_samples();
+}
+
+void Precipitation::_update_wind_samples() {
+	using_wind_samples = wind_field.is_valid();
+	if (!using_wind_samples)
+		return;
+
+	int capacity = using_compact_storage ? compact_particles.get_capacity() : particles.get_capacity();
+	int old_capacity = wind_sample_x.size();
+	if (old_capacity != capacity) {
+		wind_sample_x.resize(capacity);
+		wind_sample_y.resize(capacity);
+		wind_sample_z.resize(capacity);
+	}
+	wind_sample_x_write = wind_sample_x.ptr();
+	wind_sample_y_write = wind_sample_y.ptr();
+	wind_sample_z_write = wind_sample_z.ptr();
+
+	// Drops without a sample yet are drawn and cut off with the shared wind alone until their next step.
+	for (int i = old_capacity; i < capacity; i++) {
+		wind_sample_x_write[i] = 0;
+		wind_sample_y_write[i] = 0;
+		wind_sample_z_write[i] = 0;
+	}
+}
+
+void Precipitation::set_wind_field(const Ref<PrecipitationWindField> &p_wind_field) {
+	wind_field = p_wind_field;
+	_update_wind_samples();
+}
+
+void Precipitation::populate_particles(const float p_delta) {
+	uint32_t target_count = MAX(0, (int)(max_particles * percentage * governor_quality));
+	uint32_t particle_count = _get_particle_count();
+
+	if (target_count == particle_count) {
+		population_carry = 0;
+		return;
+	}
+
+	// The whole budget is reserved once, so moving the active count is only a watermark change plus
+	// spawning the drops that become active.
+	uint32_t capacity;
+	if (using_compact_storage) {
+		compact_particles.reserve(MAX(max_particles, 0));
+		capacity = compact_particles.get_capacity();
+	}
+	else {
+		particles.reserve(MAX(max_particles, 0));
+		capacity = particles.get_capacity();
+	}
+	_update_wind_samples();
+	target_count = MIN(target_count, capacity);
+
+	uint32_t new_particle_count = target_count;
+	if (population_ramp_rate > 0) {
+		float step = population_ramp_rate * p_delta + population_carry;
+		uint32_t max_change = (uint32_t)step;
+		population_carry = step - max_change;
+
+		if (target_count > particle_count)
+			new_particle_count = MIN(target_count, particle_count + max_change);
+		else
+			new_particle_count = MAX(target_count, particle_count - MIN(max_change, particle_count));
+	}
+
+	if (new_particle_count <= particle_count) {
+		if (using_compact_storage)
+			compact_particles.resize(new_particle_count);
+		else
+			particles.resize(new_particle_count);
+		return;
+	}
+
+	uint32_t first = using_compact_storage ? compact_particles.spawn(new_particle_count - particle_count) : particles.spawn(new_particle_count - particle_count);
+	spawn_particles(first, new_particle_count);
+}
+
+// Leads a saved state; every field is four bytes, so there is no padding to differ between compilers.
+struct PrecipitationStateHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t compact;
+	uint32_t count;
+	uint32_t seed;
+	uint32_t counter;
+	uint32_t tile_valid;
+	float box[6];
+	float tile_origin[3];
+	float population_carry;
+	float simulation_time;
+};
+
+enum {
+	PRECIPITATION_STATE_MAGIC = 0x54534350, // "PCST"
+	PRECIPITATION_STATE_VERSION = 2
+};
+
+int Precipitation::_get_state_arrays(StateArray *r_arrays) const {
+	if (using_compact_storage) {
+		const PrecipitationCompactPool &pool = compact_particles;
+		StateArray arrays[] = {
+			{ pool.position_x, sizeof(uint16_t) },
+			{ pool.position_y, sizeof(uint16_t) },
+			{ pool.position_z, sizeof(uint16_t) },
+			{ pool.hit_height, sizeof(uint16_t) },
+			{ pool.tex_coord_index, sizeof(uint16_t) },
+			{ pool.speed, sizeof(uint8_t) },
+			{ pool.inv_mass, sizeof(uint8_t) },
+			{ pool.flags, sizeof(uint8_t) },
+			{ pool.lod_band, sizeof(uint8_t) },
+		};
+		copymem(r_arrays, arrays, sizeof(arrays));
+		return sizeof(arrays) / sizeof(StateArray);
+	}
+
+	const PrecipitationParticlePool &pool = particles;
+	StateArray arrays[] = {
+		{ pool.position_x, sizeof(float) },
+		{ pool.position_y, sizeof(float) },
+		{ pool.position_z, sizeof(float) },
+		{ pool.velocity, sizeof(float) },
+		{ pool.inv_mass, sizeof(float) },
+		{ pool.hit_height, sizeof(float) },
+		{ pool.tex_coord_index, sizeof(uint32_t) },
+		{ pool.flags, sizeof(uint8_t) },
+		{ pool.lod_band, sizeof(uint8_t) },
+	};
+	copymem(r_arrays, arrays, sizeof(arrays));
+	return sizeof(arrays) / sizeof(StateArray);
+}
+
+DVector<uint8_t> Precipitation::save_state() const {
+	uint32_t count = _get_particle_count();
+
+	PrecipitationStateHeader header;
+	header.magic = PRECIPITATION_STATE_MAGIC;
+	header.version = PRECIPITATION_STATE_VERSION;
+	header.compact = using_compact_storage;
+	header.count = count;
+	header.seed = random.get_seed();
+	header.counter = random.get_counter();
+	header.tile_valid = tile_valid;
+	for (int i = 0; i < 3; i++) {
+		header.box[i] = visibility_box.pos[i];
+		header.box[i + 3] = visibility_box.size[i];
+		header.tile_origin[i] = tile_origin[i];
+	}
+	header.population_carry = population_carry;
+	header.simulation_time = simulation_time;
+
+	StateArray arrays[MAX_STATE_ARRAYS];
+	int array_count = _get_state_arrays(arrays);
+
+	uint32_t size = sizeof(header) + (using_compact_storage ? sizeof(PrecipitationCompactPool::Frame) : 0);
+	for (int i = 0; i < array_count; i++) {
+		size += count * arrays[i].element_size;
+	}
+
+	DVector<uint8_t> state;
+	state.resize(size);
+
+	// Each array goes in with one copy, straight out of the pool.
+	DVector<uint8_t>::Write w = state.write();
+	uint8_t *data = w.ptr();
+	copymem(data, &header, sizeof(header));
+	data += sizeof(header);
+	if (using_compact_storage) {
+		copymem(data, &compact_frame, sizeof(compact_frame));
+		data += sizeof(compact_frame);
+	}
+	for (int i = 0; i < array_count; i++) {
+		if (count == 0)
+			break;
+		copymem(data, arrays[i].data, count * arrays[i].element_size);
+		data += count * arrays[i].element_size;
+	}
+
+	return state;
+}
+
+Error Precipitation::load_state(const DVector<uint8_t> &p_state) {
+	PrecipitationStateHeader header;
+	ERR_FAIL_COND_V(p_state.size() < (int)sizeof(header), ERR_INVALID_DATA);
+
+	DVector<uint8_t>::Read r = p_state.read();
+	const uint8_t *data = r.ptr();
+	copymem(&header, data, sizeof(header));
+	data += sizeof(header);
+
+	ERR_FAIL_COND_V(header.magic != PRECIPITATION_STATE_MAGIC || header.version != PRECIPITATION_STATE_VERSION, ERR_INVALID_DATA);
+	if ((header.compact != 0) != using_compact_storage) {
+		ERR_EXPLAIN("The state was saved with a different storage mode.");
+		ERR_FAIL_V(ERR_INVALID_DATA);
+	}
+
+	uint64_t size = sizeof(header) + (using_compact_storage ? sizeof(PrecipitationCompactPool::Frame) : 0);
+	StateArray arrays[MAX_STATE_ARRAYS];
+	int array_count = _get_state_arrays(arrays);
+	for (int i = 0; i < array_count; i++) {
+		size += (uint64_t)header.count * arrays[i].element_size;
+	}
+	ERR_FAIL_COND_V(size != (uint64_t)p_state.size(), ERR_INVALID_DATA);
+
+	uint32_t count = header.count;
+	if (using_compact_storage) {
+		copymem(&compact_frame, data, sizeof(compact_frame));
+		data += sizeof(compact_frame);
+		compact_particles.reserve(MAX((uint32_t)MAX(max_particles, 0), count));
+		compact_particles.resize(count);
+	}
+	else {
+		particles.reserve(MAX((uint32_t)MAX(max_particles, 0), count));
+		particles.resize(count);
+	}
+	_update_wind_samples();
+
+	// Fetched again, as making room may have moved the arrays.
+	_get_state_arrays(arrays);
+	for (int i = 0; i < array_count; i++) {
+		if (count == 0)
+			break;
+		copymem(arrays[i].data, data, count * arrays[i].element_size);
+		data += count * arrays[i].element_size;
+	}
+
+	random.set_seed(header.seed);
+	random.seek(header.counter);
+	tile_valid = header.tile_valid != 0;
+	for (int i = 0; i < 3; i++) {
+		visibility_box.pos[i] = header.box[i];
+		visibility_box.size[i] = header.box[i + 3];
+		tile_origin[i] = header.tile_origin[i];
+	}
+	population_carry = header.population_carry;
+	simulation_time = header.simulation_time;
+	render_time = simulation_time;
+	splashes.clear();
+
+	// The atlas may be smaller than the one the state was saved with.
+	_fold_tex_coords();
+
+	// Drops still waiting for a ray when the state was saved ask for it again.
+	pending_cutoffs.clear();
+	const uint8_t *flags = _get_particle_flags();
+	for (uint32_t i = 0; i < count; i++) {
+		if (flags[i] & PrecipitationParticlePool::FLAG_PENDING_CUTOFF)
+			pending_cutoffs.push_back(i);
+	}
+
+	return OK;
+}
+
+void Precipitation::prewarm(const float p_seconds) {
+	ERR_FAIL_COND(!camera_node);
+	ERR_FAIL_COND(using_collision && !dss);
+
+	if (render_mode == RENDER_MODE_PROCEDURAL || p_seconds <= 0)
+		return;
+
+	float step = simulation_rate > 0 ? 1.0 / simulation_rate : 1.0 / OS::get_singleton()->get_iterations_per_second();
+	int steps = (int)Math::ceil(p_seconds / step);
+
+	// Not a frame anyone saw, so it is left out of the statistics.
+	bool was_stats_enabled = stats_enabled;
+	stats_enabled = false;
+
+	_update_visibility_box();
+	for (int i = 0; i < steps; i++) {
+		_precipitation_process(step);
+	}
+
+	stats_enabled = was_stats_enabled;
+	governor_frame_usec = 0;
+	simulation_time = 0;
+	last_step_time = step;
+	render_time = 0;
+}
+
+void Precipitation::_notification(int p_what) {
+	switch(p_what) {
+
+		case NOTIFICATION_ENTER_TREE: {
+			for (int i = 0; i < views.size(); i++) {
+				_create_view_nodes(views[i]);
+			}
+
+			procedural_mesh = Ref<Mesh>(memnew(Mesh));
+			procedural_instance = memnew( MeshInstance );
+			procedural_instance->set_mesh(procedural_mesh);
+			add_child(procedural_instance);
+
+			procedural_instance->set_layer_mask(visibility_mask);
+			if (drop_particle_material.is_valid()) {
+				procedural_instance->set_material_override(drop_particle_material);
+			}
+
+			visibility_box = AABB(Vector3(), Vector3(box_size.x, box_size.y, box_size.x));
+			pending_update = true;
+
+			if (using_batching)
+				PrecipitationBatcher::get_singleton()->register_emitter(this);
+		} break;
+		case NOTIFICATION_READY: {
+			camera_node = _find_camera(camera_path);
+			for (int i = 0; i < views.size(); i++) {
+				views[i]->camera = _find_camera(views[i]->camera_path);
+			}
+
+			set_fixed_process(true);
+			set_process(true);
+
+			w3d = get_world();
+			ERR_BREAK(w3d.is_null());
+
+			dss = PhysicsServer::get_singleton()->space_get_direct_state(w3d->get_space());
+			ERR_BREAK(!dss);
+		} break;
+		case NOTIFICATION_EXIT_TREE: {
+			_finish_mesh_jobs(false);
+
+			if (using_batching)
+				PrecipitationBatcher::get_singleton()->unregister_emitter(this);
+		} break;
+		case NOTIFICATION_FIXED_PROCESS: {
+			if (render_mode == RENDER_MODE_PROCEDURAL)
+				break;
+
+			_update_visibility_box();
+			_stats_next_frame();
+
+			float delta = get_fixed_process_delta_time();
+
+			if (simulation_rate > 0) {
+				float step = 1.0 / simulation_rate;
+				simulation_time += delta;
+
+				for (int i = 0; i < MAX_STEPS_PER_TICK && simulation_time >= step; i++) {
+					_precipitation_process(step);
+					simulation_time -= step;
+				}
+
+				// Drop what could not be caught up on rather than spiralling after a hitch.
+				if (simulation_time >= step)
+					simulation_time = 0;
+
+				last_step_time = step;
+			}
+			else {
+				_precipitation_process(delta);
+				last_step_time = delta;
+			}
+
+			render_time = simulation_time;
+		} break;
+		case NOTIFICATION_PROCESS: {
+			float delta = get_process_delta_time();
+
+			if (render_mode == RENDER_MODE_PROCEDURAL) {
+				ShaderMaterial *shader_material = NULL;
+				if (drop_particle_material.is_valid() && camera_node) {
+					shader_material = drop_particle_material->cast_to<ShaderMaterial>();
+					if (shader_material)
+						shader_material->set_shader_param("CameraPosition", camera_node->get_global_transform().origin);
+					else if (!procedural_material_warned) {
+						WARN_PRINT("Procedural render mode needs a ShaderMaterial using the procedural shader code; the drops will not move.");
+						procedural_material_warned = true;
+					}
+				}
+
+				_update_visibility_box();
+				_update_procedural(shader_material, delta);
+				break;
+			}
+
+			render_time += delta;
+
+			if (using_batching)
+				PrecipitationBatcher::get_singleton()->queue_flush();
+
+			uint64_t draw_start = _stats_ticks();
+			draw_particles();
+			uint64_t draw_usec = _stats_ticks() - draw_start;
+			if (stats_enabled)
+				stats_current[STAT_DRAW_USEC] += draw_usec;
+
+			if (frame_budget_usec > 0) {
+				governor_frame_usec += draw_usec;
+				_update_governor(delta);
+			}
+		} break;
+	}
+}
+
+void Precipitation::_update_visibility_box() {
+	Vector3 camera_pos = camera_node ? camera_node->get_global_transform().origin : Vector3();
+	Vector3 size = Vector3(box_size.x, box_size.y, box_size.x);
+	visibility_box.set_size(size);
+
+	if (tile_count == 0) {
+		visibility_box.set_pos(camera_pos);
+		return;
+	}
+
+	// The box covers tile_count world-aligned tiles per axis and only moves a whole tile at a time, once the
+	// camera has left its tile by a quarter of a tile. Drops in the tiles that stay keep their positions and
+	// cutoffs; only the ones in tiles leaving the box wrap into the tiles entering it.
+	Vector3 tile_size = size / tile_count;
+	for (int i = 0; i < 3; i++) {
+		float tile = camera_pos[i] / tile_size[i];
+		if (!tile_valid || tile < tile_origin[i] - 0.25 || tile > tile_origin[i] + 1.25)
+			tile_origin[i] = Math::floor(tile);
+	}
+	tile_valid = true;
+
+	Vector3 box_min = (tile_origin - Vector3(tile_count / 2, tile_count / 2, tile_count / 2)) * tile_size;
+	visibility_box.set_pos(box_min + size * 0.5);
+}
+
+void Precipitation::update_render_cache() {
+	cached_coordinates.resize(drops_per_texture * drops_per_texture * 4);
+	float uv_size = 1.0 / drops_per_texture;
+
+	for (int i = 0; i < (drops_per_texture * drops_per_texture); i++) {
+		int index = i * 4;
+
+		int x_modulo = (i % drops_per_texture);
+		float x_uv_position = uv_size * x_modulo;
+		float y_uv_position = uv_size * (i - x_modulo) / drops_per_texture;
+
+		cached_coordinates[index] = Vector2(x_uv_position, y_uv_position);
+		cached_coordinates[index + 1] = Vector2(x_uv_position + uv_size, y_uv_position);
+		cached_coordinates[index + 2] = Vector2(x_uv_position, y_uv_position + uv_size);
+		cached_coordinates[index + 3] = Vector2(x_uv_position + uv_size, y_uv_position + uv_size);
+	}
+}
+
+void Precipitation::_fold_tex_coords() {
+	// Folding keeps the drops whose cell still exists on it and draws nothing from the generator.
+	uint32_t cell_count = drops_per_texture * drops_per_texture;
+	uint32_t count = _get_particle_count();
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t cell = using_compact_storage ? compact_particles.tex_coord_index[i] : particles.tex_coord_index[i];
+		if (cell < cell_count)
+			continue;
+		if (using_compact_storage)
+			compact_particles.tex_coord_index[i] = cell % cell_count;
+		else
+			particles.tex_coord_index[i] = cell % cell_count;
+	}
+}
+
+void Precipitation::_precipitation_process(const float p_delta) {
+	if (is_hidden())
+		return;
+
+	if (using_compact_storage) {
+		// Stored speeds and masses are levels of these ranges, so they follow the ranges when they change.
+		compact_particles.set_ranges(min_speed, max_speed, 1.0 / MAX(max_mass, CMP_EPSILON), 1.0 / MAX(min_mass, CMP_EPSILON));
+		if (compact_particles.size() == 0)
+			compact_frame.set_box(visibility_box.pos - visibility_box.size * 0.5, visibility_box.size);
+		_update_compact_scratch();
+	}
+
+	if (pending_update) {
+		update_render_cache();
+		// The atlas may have shrunk; only the drops whose cell is now past its end move.
+		_fold_tex_coords();
+		pending_update = false;
+	}
+
+	// Follows max_particles and percentage every step; free once the count has reached its target.
+	populate_particles(p_delta);
+
+	if (camera_node == NULL)
+		return;
+
+	uint32_t count = _get_particle_count();
+	wrapped_indices.resize(count);
+	impact_indices.resize(count);
+
+	// Speeds and wind are tuned per reference step; scale them to the time this step covers.
+	float steps = p_delta * SIMULATION_REFERENCE_RATE;
+	step_params.wind_x = wind_velocity.x * steps;
+	step_params.wind_y = wind_velocity.y * steps;
+	step_params.wind_z = wind_velocity.z * steps;
+	step_params.fall_scale = steps;
+	step_params.box_min_x = visibility_box.pos.x - visibility_box.size.x * 0.5;
+	step_params.box_min_y = visibility_box.pos.y - visibility_box.size.y * 0.5;
+	step_params.box_min_z = visibility_box.pos.z - visibility_box.size.z * 0.5;
+	step_params.box_size_x = visibility_box.size.x;
+	step_params.box_size_y = visibility_box.size.y;
+	step_params.box_size_z = visibility_box.size.z;
+
+	if (using_compact_storage) {
+		compact_step_frame.set_box(Vector3(step_params.box_min_x, step_params.box_min_y, step_params.box_min_z), visibility_box.size);
+		compact_step_frame.dither = compact_frame.dither + 2654435769u;
+	}
+
+	_update_wind_samples();
+	if (using_wind_samples)
+		wind_sample_scale = steps;
+
+	uint32_t chunk_count = (count + SIMULATION_CHUNK_SIZE - 1) / SIMULATION_CHUNK_SIZE;
+	chunk_wrapped_counts.resize(chunk_count);
+	chunk_impact_counts.resize(chunk_count);
+
+	// Workers write through raw pointers so they never touch the Vectors' copy-on-write machinery.
+	chunk_wrapped_write = chunk_wrapped_counts.ptr();
+	wrapped_write = wrapped_indices.ptr();
+	chunk_impact_write = chunk_impact_counts.ptr();
+	impact_write = impact_indices.ptr();
+
+	uint64_t simulate_start = _stats_ticks();
+
+	if (worker_pool) {
+		worker_pool->run(_simulate_chunk, this, chunk_count);
+	}
+	else {
+		for (uint32_t i = 0; i < chunk_count; i++) {
+			_simulate_chunk(this, i, 0);
+		}
+	}
+
+	// Every drop has been encoded into this step's box, which the other passes now decode with.
+	if (using_compact_storage)
+		compact_frame = compact_step_frame;
+
+	uint64_t cutoff_start = _stats_ticks();
+
+	if (using_collision)
+		_update_occlusion_cache();
+
+	// Physics access stays on this thread: wrapped particles are resolved after the parallel phase,
+	// chunk by chunk, so the result is the same whatever the thread count. Drops that fell through the
+	// floor are respawned in one batch first.
+	const uint32_t *wrapped = wrapped_indices.ptr();
+	uint32_t wrapped_total = 0;
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		wrapped_total += chunk_wrapped_counts[i];
+	}
+
+	respawn_indices.resize(wrapped_total);
+	uint32_t *respawn = respawn_indices.ptr();
+	uint32_t respawn_count = 0;
+	const uint8_t *flags = _get_particle_flags();
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		const uint32_t *chunk_wrapped = wrapped + i * SIMULATION_CHUNK_SIZE;
+		for (uint32_t j = 0; j < chunk_wrapped_counts[i]; j++) {
+			if (flags[chunk_wrapped[j]] & PrecipitationParticlePool::FLAG_RESPAWN)
+				respawn[respawn_count++] = chunk_wrapped[j];
+		}
+	}
+
+	respawn_particles(respawn, respawn_count);
+
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		_dispatch_cutoff_points(wrapped + i * SIMULATION_CHUNK_SIZE, chunk_wrapped_counts[i]);
+	}
+
+	if (using_splashes) {
+		// Splashes sit where the drops crossed their cutoff, so they need no physics of their own.
+		splashes.advance(p_delta);
+
+		const uint32_t *impacts = impact_indices.ptr();
+		for (uint32_t i = 0; i < chunk_count; i++) {
+			const uint32_t *chunk_impacts = impacts + i * SIMULATION_CHUNK_SIZE;
+			for (uint32_t j = 0; j < chunk_impact_counts[i]; j++) {
+				uint32_t index = chunk_impacts[j];
+				Vector3 position = _get_particle_position(index);
+				splashes.spawn(position.x, _get_particle_hit_height(index), position.z);
+			}
+		}
+	}
+
+	int raycasts = 0;
+	if (using_collision) {
+		// A batch still in flight when async collision is switched off is collected, but not followed by another.
+		if (using_async_collision || async_collision.is_busy())
+			raycasts += async_collision.process(occlusion_cache, dss, occlusion_bounds, collision_mask, using_async_collision ? _get_governed_raycast_budget() : 0);
+		if (!using_async_collision)
+			raycasts += occlusion_cache.process_queue(dss, collision_mask, _get_governed_raycast_budget());
+		_resolve_pending_cutoffs();
+	}
+
+	if (frame_budget_usec > 0)
+		governor_frame_usec += _stats_ticks() - simulate_start;
+
+	if (stats_enabled) {
+		stats_current[STAT_SIMULATE_USEC] += cutoff_start - simulate_start;
+		stats_current[STAT_CUTOFF_USEC] += _stats_ticks() - cutoff_start;
+		stats_current[STAT_RAYCASTS] += raycasts;
+		stats_current[STAT_PARTICLES_LIVE] = count;
+
+		uint32_t valid = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			valid += flags[i] & PrecipitationParticlePool::FLAG_VALID;
+		}
+		stats_current[STAT_PARTICLES_VALID] = valid;
+	}
+}
+
+uint64_t Precipitation::_stats_ticks() const {
+	return stats_enabled || frame_budget_usec > 0 ? OS::get_singleton()->get_ticks_usec() : 0;
+}
+
+void Precipitation::_stats_next_frame() {
+	if (!stats_enabled)
+		return;
+
+	// A frame is one fixed tick plus the draws that follow it, so it is recorded when the next tick starts.
+	if (stats_frame_open) {
+		for (int i = 0; i < STAT_MAX; i++) {
+			stats_history[i][stats_frame] = stats_current[i];
+		}
+
+		stats_frame = (stats_frame + 1) % STATS_WINDOW;
+		stats_recorded = MIN(stats_recorded + 1, (int)STATS_WINDOW);
+	}
+
+	// Timings and raycasts add up over the frame; the counts hold their latest value.
+	stats_current[STAT_SIMULATE_USEC] = 0;
+	stats_current[STAT_CUTOFF_USEC] = 0;
+	stats_current[STAT_DRAW_USEC] = 0;
+	stats_current[STAT_RAYCASTS] = 0;
+	stats_frame_open = true;
+}
+
+void Precipitation::set_stats_enabled(const bool p_stats_enabled) {
+	stats_enabled = p_stats_enabled;
+	reset_stats();
+}
+
+void Precipitation::reset_stats() {
+	for (int i = 0; i < STAT_MAX; i++) {
+		stats_current[i] = 0;
+	}
+	stats_frame = 0;
+	stats_recorded = 0;
+	stats_frame_open = false;
+}
+
+float Precipitation::get_stat(Stat p_stat) const {
+	ERR_FAIL_INDEX_V(p_stat, STAT_MAX, 0);
+	return stats_current[p_stat];
+}
+
+Dictionary Precipitation::get_stats() const {
+	static const char *names[STAT_MAX] = {
+		"simulate_usec",
+		"cutoff_usec",
+		"draw_usec",
+		"raycasts",
+		"particles_live",
+		"particles_valid",
+		"particles_rendered",
+		"vertices",
+	};
+
+	Dictionary stats;
+	for (int i = 0; i < STAT_MAX; i++) {
+		float min_value = 0;
+		float max_value = 0;
+		float sum = 0;
+
+		for (int j = 0; j < stats_recorded; j++) {
+			float value = stats_history[i][j];
+			min_value = j == 0 ? value : MIN(min_value, value);
+			max_value = j == 0 ? value : MAX(max_value, value);
+			sum += value;
+		}
+
+		Dictionary stat;
+		stat["current"] = stats_current[i];
+		stat["min"] = min_value;
+		stat["avg"] = stats_recorded ? sum / stats_recorded : 0.0;
+		stat["max"] = max_value;
+		stats[names[i]] = stat;
+	}
+
+	stats["frames"] = stats_recorded;
+	stats["quality"] = governor_quality;
+	return stats;
+}
+
+void Precipitation::_update_governor(const float p_delta) {
+	float cost = governor_frame_usec;
+	governor_frame_usec = 0;
+
+	// Smoothed over about a quarter of a second, so a single expensive frame, such as many drops wrapping at
+	// once, does not pull the quality down on its own.
+	governor_cost += (cost - governor_cost) * MIN(p_delta * 4.0, 1.0);
+
+	// The quality only ever moves a little per frame, so the population fades rather than popping, and it
+	// holds anywhere between the recovery threshold and the budget so it does not hunt around the budget.
+	float quality = governor_quality;
+	if (governor_cost > frame_budget_usec)
+		quality -= GOVERNOR_DEGRADE_RATE * p_delta;
+	else if (governor_cost < frame_budget_usec * GOVERNOR_RECOVER_THRESHOLD)
+		quality += GOVERNOR_RECOVER_RATE * p_delta;
+	quality = CLAMP(quality, GOVERNOR_MIN_QUALITY, 1.0);
+
+	bool was_degraded = governor_quality < 1;
+	governor_quality = quality;
+
+	if (quality < 1 && !was_degraded)
+		emit_signal("quality_degraded", quality);
+	else if (quality >= 1 && was_degraded)
+		emit_signal("quality_restored");
+}
+
+void Precipitation::set_frame_budget_usec(const int p_frame_budget_usec) {
+	frame_budget_usec = MAX(p_frame_budget_usec, 0);
+	if (frame_budget_usec > 0)
+		return;
+
+	bool was_degraded = governor_quality < 1;
+	governor_quality = 1;
+	governor_cost = 0;
+	governor_frame_usec = 0;
+
+	if (was_degraded)
+		emit_signal("quality_restored");
+}
+
+void Precipitation::_cull_particles(View *p_view) {
+	Vector3 cam_pos = p_view->camera->get_global_transform().origin;
+	Vector<Plane> planes = p_view->camera->get_frustum();
+
+	for (int i = 0; i < PrecipitationCullParams::PLANE_COUNT; i++) {
+		if (i < planes.size()) {
+			cull_params.plane_x[i] = planes[i].normal.x;
+			cull_params.plane_y[i] = planes[i].normal.y;
+			cull_params.plane_z[i] = planes[i].normal.z;
+			cull_params.plane_d[i] = planes[i].d;
+		}
+		else {
+			cull_params.plane_x[i] = 0;
+			cull_params.plane_y[i] = 0;
+			cull_params.plane_z[i] = 0;
+			cull_params.plane_d[i] = 1e30;
+		}
+	}
+
+	cull_params.camera_x = cam_pos.x;
+	cull_params.camera_y = cam_pos.y;
+	cull_params.camera_z = cam_pos.z;
+
+	uint32_t chunk_count = (_get_particle_count() + SIMULATION_CHUNK_SIZE - 1) / SIMULATION_CHUNK_SIZE;
+	chunk_visible_counts.resize(chunk_count * PrecipitationCullParams::MAX_LOD_BANDS);
+	chunk_visible_write = chunk_visible_counts.ptr();
+
+	if (worker_pool) {
+		worker_pool->run(_cull_chunk, this, chunk_count);
+	}
+	else {
+		for (uint32_t i = 0; i < chunk_count; i++) {
+			_cull_chunk(this, i, 0);
+		}
+	}
+
+	p_view->visible_count = 0;
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		p_view->lod_band_visible[i] = 0;
+	}
+
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		for (int j = 0; j < PrecipitationCullParams::MAX_LOD_BANDS; j++) {
+			uint32_t band_visible = chunk_visible_counts[i * PrecipitationCullParams::MAX_LOD_BANDS + j];
+			p_view->lod_band_visible[j] += band_visible;
+			p_view->visible_count += band_visible;
+		}
+	}
+}
+
+void Precipitation::_update_lod_bands() {
+	// N distances split the box into N + 1 bands around the camera; missing densities and scales are 1.
+	int boundary_count = MIN(lod_band_distances.size(), PrecipitationCullParams::MAX_LOD_BANDS - 1);
+	lod_band_count = boundary_count + 1;
+
+	DVector<real_t>::Read distances = lod_band_distances.read();
+	DVector<real_t>::Read densities = lod_band_densities.read();
+	DVector<real_t>::Read size_scales = lod_band_size_scales.read();
+
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS - 1; i++) {
+		cull_params.lod_band_distance_squared[i] = i < boundary_count ? distances[i] * distances[i] : 1e30;
+	}
+
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		bool used = i < lod_band_count;
+		cull_params.lod_band_density[i] = used && i < lod_band_densities.size() ? CLAMP(densities[i], 0.0, 1.0) : 1.0;
+		lod_band_scale[i] = used && i < lod_band_size_scales.size() ? MAX(size_scales[i], 0.0) : 1.0;
+		// Larger, sparser far quads are drawn fainter so the band keeps roughly the same weight on screen.
+		lod_band_alpha[i] = lod_band_scale[i] > 1.0 ? 1.0 / lod_band_scale[i] : 1.0;
+	}
+}
+
+Precipitation::DrawCounts Precipitation::_get_draw_counts(const View *p_view) {
+	DrawCounts counts;
+	counts.visible = p_view->visible_count;
+	counts.splashes = p_view->splash_count;
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		counts.lod_band_visible[i] = p_view->lod_band_visible[i];
+	}
+	return counts;
+}
+
+DVector<int> Precipitation::get_lod_band_counts() const {
+	DVector<int> counts;
+	counts.resize(lod_band_count);
+	{
+		DVector<int>::Write w = counts.write();
+		for (int i = 0; i < lod_band_count; i++) {
+			w[i] = views[0]->shown_counts.lod_band_visible[i];
+		}
+	}
+	return counts;
+}
+
+Camera *Precipitation::_find_camera(const NodePath &p_path) const {
+	if (p_path.is_empty() || !has_node(p_path))
+		return NULL;
+
+	return static_cast<Camera *>(get_node(p_path));
+}
+
+void Precipitation::_create_view_nodes(View *p_view) {
+	if (p_view->immediate_geometry == NULL) {
+		p_view->immediate_geometry = memnew( ImmediateGeometry );
+		add_child(p_view->immediate_geometry);
+	}
+
+	if (p_view->mesh_instance == NULL) {
+		p_view->mesh = Ref<Mesh>(memnew(Mesh));
+		p_view->mesh_instance = memnew( MeshInstance );
+		p_view->mesh_instance->set_mesh(p_view->mesh);
+		add_child(p_view->mesh_instance);
+	}
 
-		PhysicsDirectSpaceState::RayResult rr;
-		if (dss->intersect_ray(from, to, rr, exclude, collision_mask, PhysicsDirectSpaceState::TYPE_MASK_STATIC_BODY))
-			p_particle->hit_pos = rr.position;
-		else
-			p_particle->hit_pos = Vector3(0,-1000,0);
+	p_view->immediate_geometry->set_layer_mask(p_view->layer_mask);
+	p_view->mesh_instance->set_layer_mask(p_view->layer_mask);
+	if (drop_particle_material.is_valid()) {
+		p_view->immediate_geometry->set_material_override(drop_particle_material);
+		p_view->mesh_instance->set_material_override(drop_particle_material);
+	}
+}
 
-		p_particle->is_valid = p_particle->position.y > p_particle->hit_pos.y;
+void Precipitation::_free_view_nodes(View *p_view) {
+	if (p_view->immediate_geometry != NULL) {
+		p_view->immediate_geometry->queue_delete();
+		p_view->immediate_geometry = NULL;
 	}
-	else {
-		p_particle->hit_pos = Vector3(0, -1000, 0);
-		p_particle->is_valid = true;
+
+	if (p_view->mesh_instance != NULL) {
+		p_view->mesh_instance->queue_delete();
+		p_view->mesh_instance = NULL;
 	}
+
+	p_view->mesh = Ref<Mesh>();
 }
 
-void Precipitation::spawn_particle(Precipitation::Particle *p_particle, const float p_delta) {
-	p_particle->velocity = Math::randf() * (max_speed - min_speed) + min_speed;
+void Precipitation::add_view(const NodePath &p_camera, int p_layer_mask) {
+	View *view = memnew(View);
+	view->camera_path = p_camera;
+	view->camera = is_inside_tree() ? _find_camera(p_camera) : NULL;
+	view->layer_mask = p_layer_mask;
+	view->immediate_geometry = NULL;
+	view->mesh_instance = NULL;
+	view->visible_count = 0;
+	view->splash_count = 0;
+	view->back_quad_count = 0;
+	view->back_using_colors = false;
+	view->back_pending = false;
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		view->lod_band_visible[i] = 0;
+	}
+	view->shown_counts = _get_draw_counts(view);
+	view->back_counts = view->shown_counts;
 
-	p_particle->position.x = visibility_box.pos.x + Math::randf() * box_size.x - (box_size.x / 2);
-	p_particle->position.z = visibility_box.pos.z + Math::randf() * box_size.x - (box_size.x / 2);
+	views.push_back(view);
 
-	p_particle->anim_start_time = (p_delta * Math::randf());
+	if (is_inside_tree())
+		_create_view_nodes(view);
+}
 
-	p_particle->tex_coord_index = (int)(Math::randf() * (float)(drops_per_texture * drops_per_texture - 0.5));
+void Precipitation::remove_view(const NodePath &p_camera) {
+	// The mesh builder may still be writing into the view's arrays.
+	_finish_mesh_jobs(false);
 
-	p_particle->is_valid = true;
-	p_particle->time = Math::randf() * Math_PI * 2.0;
-	p_particle->mass = Math::randf() * (max_mass - min_mass) + min_mass;
+	// The first view belongs to the camera property and is never removed.
+	for (int i = 1; i < views.size(); i++) {
+		if (views[i]->camera_path == p_camera) {
+			_free_view_nodes(views[i]);
+			memdelete(views[i]);
+			views.remove(i);
+			return;
+		}
+	}
 }
 
-void Precipitation::spawn_new_particle(Precipitation::Particle *p_particle, const float p_delta) {
-	spawn_particle(p_particle, p_delta);
-	p_particle->position.y = Math::randf() * box_size.y - (box_size.y / 2);
-}
+void Precipitation::clear_views() {
+	_finish_mesh_jobs(false);
 
-void Precipitation::empty_particles() {
-	Particle *current = particle_head;
-	while (current) {
-		Particle *next = current->next;
-		memfree(current);
-		current = next;
+	while (views.size() > 1) {
+		_free_view_nodes(views[1]);
+		memdelete(views[1]);
+		views.remove(1);
 	}
-	particle_head = NULL;
 }
 
-void Precipitation::populate_particles(const float p_delta) {
-	int new_particle_count = (max_particles * percentage);
-	int particle_count = 0;
-	
-	if(new_particle_count == 0)
-		empty_particles();
-
-	if (particle_head) {
-		Particle *current = particle_head;
-		while (current) {
-			particle_count += 1;
-			current = current->next;
-			if (particle_count == new_particle_count && current) {
-				Particle *next = current->next;
-				current->next = NULL;
-				while (next) {
-					Particle *last = next;
-					next = next->next;
-					last->next = NULL;
-					memfree(last);
-				}
-				break;
-			}
-		}
+int Precipitation::get_view_count() const {
+	return views.size();
+}
+
+void Precipitation::set_drop_particle_material(Ref<Material> p_material) {
+	drop_particle_material = p_material;
+	procedural_material_warned = false;
+	for (int i = 0; i < views.size(); i++) {
+		if (views[i]->immediate_geometry != NULL)
+			views[i]->immediate_geometry->set_material_override(drop_particle_material);
+		if (views[i]->mesh_instance != NULL)
+			views[i]->mesh_instance->set_material_override(drop_particle_material);
 	}
+	if (procedural_instance != NULL)
+		procedural_instance->set_material_override(drop_particle_material);
+}
+
+void Precipitation::_simulate_chunk(void *p_self, uint32_t p_chunk, uint32_t p_thread) {
+	Precipitation *self = (Precipitation *)p_self;
+
+	uint32_t from = p_chunk * SIMULATION_CHUNK_SIZE;
+	uint32_t to = MIN(from + SIMULATION_CHUNK_SIZE, self->_get_particle_count());
+	uint32_t window_size = self->_get_window_size();
+	uint32_t *wrapped = self->wrapped_write + from;
+	uint32_t *impacts = self->impact_write + from;
+	uint32_t wrapped_count = 0;
+	uint32_t impact_count = 0;
+
+	for (uint32_t base = from, end; base < to; base = end) {
+		end = base + MIN(window_size, to - base);
+		uint32_t n = end - base;
+		PrecipitationParticlePool view;
+		PrecipitationParticlePool &window = self->_open_window(view, base, end, p_thread);
 
-	if (particle_count < new_particle_count) {
-		Particle *current = particle_head;
-		if (current) {
-			while (current->next)
-				current = current->next;
+		if (self->using_wind_samples) {
+			float *wind_x = self->wind_sample_x_write + base;
+			float *wind_y = self->wind_sample_y_write + base;
+			float *wind_z = self->wind_sample_z_write + base;
+			self->wind_field->sample_batch(window.position_x, window.position_y, window.position_z, n, wind_x, wind_y, wind_z);
+			precipitation_apply_wind(window, 0, n, wind_x, wind_y, wind_z, self->wind_sample_scale);
 		}
-		else{
-			current = memnew(Particle);
-			particle_head = current;
-			spawn_new_particle(current, p_delta);
-			particle_count += 1;
+
+		// The kernel reports indices within the window.
+		uint32_t first_wrapped = wrapped_count;
+		uint32_t first_impact = impact_count;
+		wrapped_count += precipitation_integrate_and_wrap(window, 0, n, self->step_params, wrapped + wrapped_count, impacts, &impact_count);
+		for (uint32_t i = first_wrapped; i < wrapped_count; i++) {
+			wrapped[i] += base;
 		}
-		while (particle_count < new_particle_count) {
-			current->next = memnew(Particle);
-			current = current->next;
-			spawn_new_particle(current, p_delta);
-			particle_count += 1;
+		for (uint32_t i = first_impact; i < impact_count; i++) {
+			impacts[i] += base;
 		}
+
+		if (self->using_compact_storage)
+			self->compact_particles.encode(window, base, end, self->compact_step_frame);
 	}
+
+	self->chunk_wrapped_write[p_chunk] = wrapped_count;
+	self->chunk_impact_write[p_chunk] = impact_count;
 }
 
-void Precipitation::wrap_particle(Precipitation::Particle *p_particle, AABB &p_box, Vector3 &p_wind_velocity, const float p_delta) {
-	if (p_particle->position.y < (p_box.pos.y - (p_box.size.y * 0.5))) {
-		spawn_particle(p_particle, p_delta);
-		while (p_particle->position.y < (p_box.pos.y - (p_box.size.y * 0.5)))
-			p_particle->position.y += box_size.y;
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+void Precipitation::_cull_chunk(void *p_self, uint32_t p_chunk, uint32_t p_thread) {
+	Precipitation *self = (Precipitation *)p_self;
+
+	uint32_t from = p_chunk * SIMULATION_CHUNK_SIZE;
+	uint32_t to = MIN(from + SIMULATION_CHUNK_SIZE, self->_get_particle_count());
+	uint32_t window_size = self->_get_window_size();
+	uint32_t *chunk_visible = self->chunk_visible_write + p_chunk * PrecipitationCullParams::MAX_LOD_BANDS;
+
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		chunk_visible[i] = 0;
 	}
-	else if (p_particle->position.y >(p_box.pos.y + (p_box.size.y * 0.5))) {
-		while (p_particle->position.y >(p_box.pos.y + (p_box.size.y * 0.5))) {
-			p_particle->position.y -= box_size.y;
+
+	for (uint32_t base = from, end; base < to; base = end) {
+		end = base + MIN(window_size, to - base);
+		PrecipitationParticlePool view;
+		PrecipitationParticlePool &window = self->_open_window(view, base, end, p_thread);
+
+		uint32_t band_visible[PrecipitationCullParams::MAX_LOD_BANDS];
+		self->cull_function(window, 0, end - base, base, self->cull_params, band_visible);
+		for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+			chunk_visible[i] += band_visible[i];
 		}
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+
+		if (self->using_compact_storage)
+			self->compact_particles.encode_flags(window, base, end);
 	}
-	else if (p_particle->position.x < (p_box.pos.x - (p_box.size.x * 0.5))) {
-		while (p_particle->position.x < (p_box.pos.x - (p_box.size.x * 0.5))) {
-			p_particle->position.x += box_size.x;
-		}
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+}
+
+PrecipitationParticlePool &Precipitation::_open_window(PrecipitationParticlePool &r_view, uint32_t p_from, uint32_t p_to, uint32_t p_thread) {
+	if (!using_compact_storage) {
+		r_view.set_view(particles, p_from, p_to);
+		return r_view;
 	}
-	else if (p_particle->position.x >(p_box.pos.x + (p_box.size.x * 0.5))) {
-		while (p_particle->position.x >(p_box.pos.x + (p_box.size.x * 0.5))) {
-			p_particle->position.x -= box_size.x;
-		}
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+
+	PrecipitationParticlePool &scratch = *compact_scratch[p_thread];
+	scratch.resize(p_to - p_from);
+	compact_particles.decode(p_from, p_to, compact_frame, scratch);
+	return scratch;
+}
+
+void Precipitation::_update_compact_scratch() {
+	// One per thread that can run a job, each big enough for a window.
+	int thread_count = worker_pool ? worker_pool->get_thread_count() : 1;
+	while (compact_scratch.size() < thread_count) {
+		PrecipitationParticlePool *scratch = memnew(PrecipitationParticlePool);
+		scratch->reserve(COMPACT_WINDOW_SIZE);
+		compact_scratch.push_back(scratch);
 	}
-	else if (p_particle->position.z < (p_box.pos.z - (p_box.size.z * 0.5))) {
-		while (p_particle->position.z < (p_box.pos.z - (p_box.size.z * 0.5))) {
-			p_particle->position.z += box_size.x;
-		}
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+}
+
+void Precipitation::set_using_compact_storage(const bool p_using_compact_storage) {
+	if (using_compact_storage == p_using_compact_storage)
+		return;
+
+	using_compact_storage = p_using_compact_storage;
+	empty_particles();
+	pending_cutoffs.clear();
+}
+
+void Precipitation::set_simulation_threads(const int p_simulation_threads) {
+	simulation_threads = MAX(p_simulation_threads, 0);
+
+	int thread_count = simulation_threads == 0 ? OS::get_singleton()->get_processor_count() : simulation_threads;
+	if (thread_count > 1) {
+		if (!worker_pool)
+			worker_pool = memnew(PrecipitationWorkerPool);
+		worker_pool->set_thread_count(thread_count);
 	}
-	else if (p_particle->position.z >(p_box.pos.z + (p_box.size.z * 0.5))) {
-		while (p_particle->position.z >(p_box.pos.z + (p_box.size.z * 0.5))) {
-			p_particle->position.z -= box_size.x;
-		}
-		calculate_particle_cutoff_point(p_particle, p_box, p_wind_velocity);
+	else if (worker_pool) {
+		memdelete(worker_pool);
+		worker_pool = NULL;
 	}
 }
 
-void Precipitation::_notification(int p_what) {
-	switch(p_what) {
+void Precipitation::_clear_mesh(const Ref<Mesh> &p_mesh) {
+	if (p_mesh.is_null())
+		return;
 
-		case NOTIFICATION_ENTER_TREE: {
-			immediate_geometry = memnew( ImmediateGeometry );
-			add_child(immediate_geometry);
+	while (p_mesh->get_surface_count())
+		p_mesh->surface_remove(0);
+}
 
-			immediate_geometry->set_layer_mask(visibility_mask);
-			if (drop_particle_material.is_valid()) {
-				immediate_geometry->set_material_override(drop_particle_material);
-			}
+void Precipitation::set_using_batching(const bool p_using_batching) {
+	if (using_batching == p_using_batching)
+		return;
 
-			visibility_box = AABB(Vector3(), Vector3(box_size.x, box_size.y, box_size.x));
-			pending_update = true;
-		} break;
-		case NOTIFICATION_READY: {
-			if (has_node(camera_path)) {
-				camera_node = static_cast<Camera *>(get_node(camera_path));
-			}
-			else {
-				camera_node = NULL;
-			}
+	_finish_mesh_jobs(false);
+	using_batching = p_using_batching;
 
-			set_fixed_process(true);
+	// Only one of the batch and the views' own nodes may show the drops.
+	for (int i = 0; i < views.size(); i++) {
+		if (views[i]->immediate_geometry != NULL)
+			views[i]->immediate_geometry->clear();
+		_clear_mesh(views[i]->mesh);
+	}
 
-			w3d = get_world();
-			ERR_BREAK(w3d.is_null());
+	if (!is_inside_tree())
+		return;
 
-			dss = PhysicsServer::get_singleton()->space_get_direct_state(w3d->get_space());
-			ERR_BREAK(!dss);
-		} break;
-		case NOTIFICATION_EXIT_TREE: {
-		} break;
-		case NOTIFICATION_FIXED_PROCESS: {
-			if (drop_particle_material.is_valid() && camera_node) {
-				ShaderMaterial *shader_material = static_cast<ShaderMaterial *>(*drop_particle_material);
-				if (shader_material)
-					shader_material->set_shader_param("CameraPosition", camera_node->get_global_transform().origin);
-			}
+	if (using_batching)
+		PrecipitationBatcher::get_singleton()->register_emitter(this);
+	else
+		PrecipitationBatcher::get_singleton()->unregister_emitter(this);
+}
 
-			if (camera_node)
-				visibility_box.set_pos(camera_node->get_global_transform().origin);
-			else
-				visibility_box.set_pos(Vector3());
+void Precipitation::set_using_pipelined_meshes(const bool p_using_pipelined_meshes) {
+	if (using_pipelined_meshes == p_using_pipelined_meshes)
+		return;
 
+	// Quads still in flight are dropped; the next draw builds the frame afresh.
+	_finish_mesh_jobs(false);
+	using_pipelined_meshes = p_using_pipelined_meshes;
+}
 
-			_precipitation_process(get_fixed_process_delta_time());
+void Precipitation::set_render_mode(const RenderMode p_render_mode) {
+	_finish_mesh_jobs(false);
+	render_mode = p_render_mode;
 
-			draw_particles();
+	// Drop whatever the previous path left behind so only one of them is ever drawn.
+	for (int i = 0; i < views.size(); i++) {
+		if (render_mode != RENDER_MODE_IMMEDIATE && views[i]->immediate_geometry != NULL)
+			views[i]->immediate_geometry->clear();
 
-			break;
-		}
+		if (render_mode != RENDER_MODE_MESH)
+			_clear_mesh(views[i]->mesh);
 	}
-}
 
-void Precipitation::update_render_cache() {
-	cached_coordinates.resize(drops_per_texture * drops_per_texture * 4);
-	float uv_size = 1.0 / drops_per_texture;
+	if (render_mode != RENDER_MODE_PROCEDURAL)
+		_clear_mesh(procedural_mesh);
 
-	for (int i = 0; i < (drops_per_texture * drops_per_texture); i++) {
-		int index = i * 4;
+	// The procedural mesh and the simulated pool are built from the same settings but separately.
+	pending_update = true;
+}
 
-		int x_modulo = (i % drops_per_texture);
-		float x_uv_position = uv_size * x_modulo;
-		float y_uv_position = uv_size * (i - x_modulo) / drops_per_texture;
+void Precipitation::_update_procedural_mesh() {
+	_clear_mesh(procedural_mesh);
 
-		cached_coordinates[index] = Vector2(x_uv_position, y_uv_position);
-		cached_coordinates[index + 1] = Vector2(x_uv_position + uv_size, y_uv_position);
-		cached_coordinates[index + 2] = Vector2(x_uv_position, y_uv_position + uv_size);
-		cached_coordinates[index + 3] = Vector2(x_uv_position + uv_size, y_uv_position + uv_size);
-	}
+	uint32_t drop_count = MAX(0, (int)(max_particles * percentage));
+	if (drop_count == 0 || procedural_mesh.is_null())
+		return;
+
+	Vector3 size = Vector3(box_size.x, box_size.y, box_size.x);
+	Array arrays = PrecipitationProcedural::make_mesh_arrays(drop_count, size, min_speed, max_speed, min_mass, max_mass, drops_per_texture, cached_coordinates, random.get_seed());
+	procedural_mesh->add_surface(Mesh::PRIMITIVE_TRIANGLES, arrays);
 }
 
-void Precipitation::_precipitation_process(const float p_delta) {
+void Precipitation::_update_procedural(ShaderMaterial *p_shader_material, const float p_delta) {
 	if (is_hidden())
 		return;
 
 	if (pending_update) {
-		populate_particles(p_delta);
 		update_render_cache();
+		_update_procedural_mesh();
 		pending_update = false;
 	}
 
-	if (camera_node == NULL)
+	// Speeds and wind are expressed per reference step.
+	procedural_steps = Math::fmod(procedural_steps + p_delta * SIMULATION_REFERENCE_RATE, (float)PrecipitationProcedural::STEP_PERIOD);
+
+	Vector3 box_min = visibility_box.pos - visibility_box.size * 0.5;
+
+	// The drops are placed by the shader; the instance only needs to sit on the box for culling.
+	if (procedural_instance != NULL)
+		procedural_instance->set_global_transform(Transform(Matrix3(), box_min));
+
+	if (p_shader_material) {
+		p_shader_material->set_shader_param("PrecipitationSteps", procedural_steps);
+		p_shader_material->set_shader_param("WindVelocity", wind_velocity);
+		p_shader_material->set_shader_param("BoxMin", box_min);
+		p_shader_material->set_shader_param("BoxSize", visibility_box.size);
+		p_shader_material->set_shader_param("DropSize", drop_particle_size);
+	}
+}
+
+String Precipitation::get_procedural_shader_code() const {
+	return PrecipitationProcedural::get_vertex_shader_code();
+}
+
+void Precipitation::draw_particles() {
+	if (render_mode == RENDER_MODE_PROCEDURAL || camera_node == NULL)
+		return;
+
+	// The batch is not a child, so it does not hide with the emitter.
+	if (using_batching && !is_visible())
 		return;
 
-	Vector3 cam_pos = camera_node->get_global_transform().origin;
-	Matrix3 cam_mat = camera_node->get_global_transform().basis;
-	float cam_fov = camera_node->get_fov();
-	Vector3 cam_dir = cam_mat.elements[1].normalized();
+	cull_params.max_distance_squared = max_render_distance * max_render_distance;
 
-	Particle *curr = particle_head;
-	while (curr) {
-		curr->position += wind_velocity / curr->mass;
-		curr->position.y -= curr->velocity;
+	_update_lod_bands();
+	if (using_compact_storage)
+		_update_compact_scratch();
 
-		wrap_particle(curr, visibility_box, wind_velocity, p_delta);
+	cull_function = using_specialized_kernels ? precipitation_get_cull_function(cull_params) : precipitation_cull;
 
-		if (curr->is_valid && curr->position.y < curr->hit_pos.y) {
-			curr->is_valid = false;
+	float max_scale = 0;
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		max_scale = MAX(max_scale, lod_band_scale[i]);
+	}
+	// Drops are drawn where they have got to since the last step, never more than one step ahead.
+	render_offset = MIN(render_time, last_step_time) * SIMULATION_REFERENCE_RATE;
+	splash_age_offset = MIN(render_time, last_step_time);
+	float max_wind = wind_velocity.length() + (wind_field.is_valid() ? wind_field->get_max_speed() : 0);
+	float max_travel = (max_speed + max_wind / MAX(min_mass, CMP_EPSILON)) * render_offset;
+
+	// Half-diagonal of the largest quad, plus how far a drop can be carried from its simulated position.
+	cull_params.radius = drop_particle_size * max_scale * Math_SQRT12 * 2.0 + max_travel;
+
+	if (stats_enabled) {
+		stats_current[STAT_PARTICLES_RENDERED] = 0;
+		stats_current[STAT_VERTICES] = 0;
+	}
+
+	// Last frame's quads go up first, so every view's back buffer is free for this frame's.
+	bool pipelining = _is_pipelining();
+	if (pipelining)
+		_finish_mesh_jobs(true);
+
+	// The render flags are rewritten by every cull, so each view is culled and built before the next one.
+	for (int i = 0; i < views.size(); i++) {
+		View *view = views[i];
+		if (view->camera == NULL)
+			continue;
+
+		_cull_particles(view);
+
+		if (pipelining)
+			_queue_mesh_job(view);
+		else {
+			if (render_mode == RENDER_MODE_IMMEDIATE && !using_batching)
+				draw_particles_immediate(view);
+			else
+				draw_particles_mesh(view);
+			view->shown_counts = _get_draw_counts(view);
+		}
+
+		// Pipelined, the counts are those of the quads presented above, not of the cull just queued.
+		if (stats_enabled) {
+			const DrawCounts &shown = view->shown_counts;
+			stats_current[STAT_PARTICLES_RENDERED] += shown.visible;
+			stats_current[STAT_VERTICES] += (shown.visible + shown.splashes) * (render_mode == RENDER_MODE_IMMEDIATE && !using_batching ? 6 : 4);
 		}
+	}
 
-		curr->to_render = true;
-		curr->render_position = curr->position;
+	if (pipelining)
+		mesh_builder.start_jobs();
+}
 
-		curr = curr->next;
+uint32_t Precipitation::_count_live_splashes() const {
+	uint32_t live = 0;
+	for (uint32_t i = 0; i < splashes.size(); i++) {
+		live += splashes.age[i] + splash_age_offset < splash_lifetime;
 	}
+	return live;
 }
 
-void Precipitation::draw_particles() {
-	Vector3 pos;
-	Matrix3 cam_mat;
-	Vector3 cam_origin;
-	Vector3 right;
-	Vector3 up;
-	Vector3 right_up;
-	Vector3 left_up;
-	float distance;
-	Vector3 ortho_dir;
-	Vector3 velocity;
-	
-	Particle *curr = particle_head;
-	uint32_t vert_count = 0;
-	
-	cam_origin = camera_node->get_global_transform().origin;
-	
-	if (using_billboards) {
-		cam_mat = camera_node->get_global_transform().basis;
-		right = cam_mat[0].normalized() * drop_particle_size;
-		up = cam_mat[1].normalized() * drop_particle_size;
-		right_up = right + up;
-		left_up = -right + up;
-	}
-	
-	immediate_geometry->clear();
-	immediate_geometry->begin(Mesh::PRIMITIVE_TRIANGLES, NULL);
-	
-	while (curr) {
-		if (!curr->is_valid || !curr->to_render) {
-			curr = curr->next;
+bool Precipitation::_get_splash_corners(uint32_t p_index, const Vector3 &p_side, Vector3 *r_corners, float &r_alpha) const {
+	float t = (splashes.age[p_index] + splash_age_offset) / splash_lifetime;
+	if (t >= 1.0)
+		return false;
+
+	// Grows from half size while it fades, standing on the surface the drop hit.
+	float size = splash_size * (0.5 + 0.5 * t);
+	Vector3 base = Vector3(splashes.position_x[p_index], splashes.position_y[p_index], splashes.position_z[p_index]);
+	Vector3 side = p_side * size;
+	Vector3 up = Vector3(0, size * 2.0, 0);
+
+	// Same corner order as the drop quads.
+	r_corners[0] = base - side + up;
+	r_corners[1] = base + side + up;
+	r_corners[2] = base - side;
+	r_corners[3] = base + side;
+	r_alpha = 1.0 - t;
+	return true;
+}
+
+template <int BILLBOARDS, int COLORS>
+void Precipitation::_add_immediate_drops(View *p_view, const PrecipitationQuadParams &p_params) {
+	static const int corner_order[6] = { 0, 1, 3, 3, 2, 0 };
+
+	uint32_t count = _get_particle_count();
+	const uint8_t *flags = _get_particle_flags();
+	uint32_t window_size = _get_window_size();
+	PrecipitationParticlePool view;
+	const PrecipitationParticlePool *window = NULL;
+	uint32_t window_base = 0;
+	uint32_t window_end = 0;
+	const uint8_t render_flags = PrecipitationParticlePool::FLAG_VALID | PrecipitationParticlePool::FLAG_RENDER;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if ((flags[i] & render_flags) != render_flags)
 			continue;
+
+		// Windows start at the next drop to draw, so stretches with nothing to draw are never decoded.
+		if (i >= window_end) {
+			window_base = i;
+			window_end = i + MIN(window_size, count - i);
+			window = &_open_window(view, window_base, window_end, 0);
 		}
-		pos = curr->render_position;
-		
-		if (using_billboards == false) {
-			cam_origin.y = pos.y;
-			ortho_dir = cam_origin - pos;
-			distance = ortho_dir.length();
-			
-			if (distance > 0.0)
-				ortho_dir *= -1.0 / distance;
-			else
-				ortho_dir = -Vector3(0, 0, 1);
-			
-			velocity = wind_velocity / curr->mass;
-			velocity.z -= curr->velocity;
-			velocity = velocity.normalized();
-			
-			up = (-velocity.cross(ortho_dir)).normalized() * drop_particle_size;
-			right = (ortho_dir.cross(up) - velocity).normalized() * drop_particle_size;
-			right_up = right + up;
-			left_up = -right + up;
+		uint32_t j = i - window_base;
+
+		Vector3 corners[4];
+		Vector2 corner_uvs[4];
+		Color corner_colors[4];
+		Vector3 pos = Vector3(window->position_x[j], window->position_y[j], window->position_z[j]);
+		precipitation_build_quad<BILLBOARDS, COLORS>(p_params, pos, _get_particle_wind(i), window->inv_mass[j], window->velocity[j], window->hit_height[j], window->tex_coord_index[j], window->lod_band[j], corners, corner_uvs, corner_colors);
+
+		if (precipitation_feature_enabled<COLORS>(p_params.using_colors))
+			p_view->immediate_geometry->set_color(corner_colors[0]);
+
+		for (int k = 0; k < 6; k++) {
+			p_view->immediate_geometry->set_uv(corner_uvs[corner_order[k]]);
+			p_view->immediate_geometry->add_vertex(corners[corner_order[k]]);
+		}
+	}
+}
+
+void Precipitation::draw_particles_immediate(View *p_view) {
+	const bool using_lod = lod_band_count > 1;
+	p_view->splash_count = using_splashes ? _count_live_splashes() : 0;
+	const bool using_colors = using_lod || p_view->splash_count > 0;
+
+	PrecipitationQuadParams params;
+	_get_quad_params(p_view, using_colors, params);
+
+	p_view->immediate_geometry->clear();
+	p_view->immediate_geometry->begin(Mesh::PRIMITIVE_TRIANGLES, NULL);
+
+	if (!using_specialized_kernels)
+		_add_immediate_drops<PRECIPITATION_FEATURE_DYNAMIC, PRECIPITATION_FEATURE_DYNAMIC>(p_view, params);
+	else if (using_billboards && using_colors)
+		_add_immediate_drops<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_ON>(p_view, params);
+	else if (using_billboards)
+		_add_immediate_drops<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_OFF>(p_view, params);
+	else if (using_colors)
+		_add_immediate_drops<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_ON>(p_view, params);
+	else
+		_add_immediate_drops<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_OFF>(p_view, params);
+
+	if (p_view->splash_count) {
+		static const int corner_order[6] = { 0, 1, 3, 3, 2, 0 };
+		Vector3 side = p_view->camera->get_global_transform().basis.get_axis(0);
+		side.y = 0;
+		side = side.length() > CMP_EPSILON ? side.normalized() : Vector3(1, 0, 0);
+		uint32_t index = MIN(splash_atlas_cell, drops_per_texture * drops_per_texture - 1) * 4;
+
+		for (uint32_t i = 0; i < splashes.size(); i++) {
+			Vector3 corners[4];
+			float alpha;
+			if (!_get_splash_corners(i, side, corners, alpha))
+				continue;
+
+			p_view->immediate_geometry->set_color(Color(1, 1, 1, alpha));
+			for (int j = 0; j < 6; j++) {
+				p_view->immediate_geometry->set_uv(cached_coordinates[index + corner_order[j]]);
+				p_view->immediate_geometry->add_vertex(corners[corner_order[j]]);
+			}
 		}
-			
-		uint32_t index = curr->tex_coord_index * 4;
-			
-		immediate_geometry->set_uv(cached_coordinates[index]);
-		immediate_geometry->add_vertex(pos + left_up);
-		vert_count += 1;
-		
-		immediate_geometry->set_uv(cached_coordinates[index + 1]);
-		immediate_geometry->add_vertex(pos + right_up);
-		vert_count += 1;
-		
-		immediate_geometry->set_uv(cached_coordinates[index + 3]);
-		immediate_geometry->add_vertex(pos - left_up);
-		vert_count += 1;
-		
-		immediate_geometry->set_uv(cached_coordinates[index + 3]);
-		immediate_geometry->add_vertex(pos - left_up);
-		vert_count += 1;
-		
-		immediate_geometry->set_uv(cached_coordinates[index + 2]);
-		immediate_geometry->add_vertex(pos - right_up);
-		vert_count += 1;
-
-		immediate_geometry->set_uv(cached_coordinates[index]);
-		immediate_geometry->add_vertex(pos + left_up);
-		vert_count += 1;
-		
-		curr = curr->next;
 	}
 			
-	immediate_geometry->end();
+	p_view->immediate_geometry->end();
+}
+
+void Precipitation::_get_quad_params(View *p_view, bool p_using_colors, PrecipitationQuadParams &r_params) const {
+	Transform camera_transform = p_view->camera->get_global_transform();
+
+	r_params.camera_origin = camera_transform.origin;
+	r_params.drop_size = drop_particle_size;
+	r_params.using_billboards = using_billboards;
+	r_params.using_colors = p_using_colors;
+	r_params.render_offset = render_offset;
+	r_params.coordinates = cached_coordinates.ptr();
+	r_params.using_specialized_kernels = using_specialized_kernels;
+
+	if (using_billboards) {
+		r_params.right = camera_transform.basis[0].normalized() * drop_particle_size;
+		r_params.up = camera_transform.basis[1].normalized() * drop_particle_size;
+	}
+
+	for (int i = 0; i < PrecipitationCullParams::MAX_LOD_BANDS; i++) {
+		r_params.lod_band_scale[i] = lod_band_scale[i];
+		r_params.lod_band_alpha[i] = lod_band_alpha[i];
+	}
+}
+
+void Precipitation::_build_splash_quads(View *p_view, Vector3 *r_vertex, Vector2 *r_uv, Color *r_color) const {
+	Vector3 side = p_view->camera->get_global_transform().basis.get_axis(0);
+	side.y = 0;
+	side = side.length() > CMP_EPSILON ? side.normalized() : Vector3(1, 0, 0);
+	const Vector2 *quad_uv = cached_coordinates.ptr() + MIN(splash_atlas_cell, drops_per_texture * drops_per_texture - 1) * 4;
+
+	for (uint32_t i = 0; i < splashes.size(); i++) {
+		float alpha;
+		if (!_get_splash_corners(i, side, r_vertex, alpha))
+			continue;
+
+		Color splash_color = Color(1, 1, 1, alpha);
+		for (int j = 0; j < 4; j++) {
+			r_uv[j] = quad_uv[j];
+			r_color[j] = splash_color;
+		}
+
+		r_vertex += 4;
+		r_uv += 4;
+		r_color += 4;
+	}
+}
+
+void Precipitation::_present_view(View *p_view, uint32_t p_quad_count, bool p_using_colors) {
+	if (using_batching) {
+		if (p_quad_count > 0)
+			PrecipitationBatcher::get_singleton()->submit(this, get_world()->get_scenario(), drop_particle_material, p_view->layer_mask, get_global_transform(), p_view->vertices, p_view->uvs, p_view->colors, p_quad_count);
+		return;
+	}
+
+	_clear_mesh(p_view->mesh);
+
+	if (p_quad_count == 0)
+		return;
+
+	// The index pattern never changes, so only the quads added since the last frame need writing. The
+	// batcher indexes its merged arrays itself.
+	int old_index_count = p_view->indices.size();
+	int index_count = p_quad_count * 6;
+	p_view->indices.resize(index_count);
+	if (index_count > old_index_count) {
+		DVector<int>::Write w = p_view->indices.write();
+		for (int i = old_index_count; i < index_count; i += 6) {
+			int base = (i / 6) * 4;
+			w[i + 0] = base;
+			w[i + 1] = base + 1;
+			w[i + 2] = base + 3;
+			w[i + 3] = base + 3;
+			w[i + 4] = base + 2;
+			w[i + 5] = base;
+		}
+	}
+
+	Array arrays;
+	arrays.resize(Mesh::ARRAY_MAX);
+	arrays[Mesh::ARRAY_VERTEX] = p_view->vertices;
+	arrays[Mesh::ARRAY_TEX_UV] = p_view->uvs;
+	if (p_using_colors)
+		arrays[Mesh::ARRAY_COLOR] = p_view->colors;
+	arrays[Mesh::ARRAY_INDEX] = p_view->indices;
+	p_view->mesh->add_surface(Mesh::PRIMITIVE_TRIANGLES, arrays);
+}
+
+void Precipitation::_queue_mesh_job(View *p_view) {
+	PrecipitationMeshBuilder::Job *job = mesh_builder.add_job();
+	ERR_FAIL_COND(!job);
+
+	uint32_t count = _get_particle_count();
+	const uint8_t *flags = _get_particle_flags();
+	uint32_t window_size = _get_window_size();
+	PrecipitationParticlePool view;
+	const PrecipitationParticlePool *window = NULL;
+	uint32_t window_base = 0;
+	uint32_t window_end = 0;
+	const uint8_t render_flags = PrecipitationParticlePool::FLAG_VALID | PrecipitationParticlePool::FLAG_RENDER;
+
+	// The drops to draw are copied out, so the next step can move the pool on while the worker builds them.
+	PrecipitationParticlePool &drops = job->drops;
+	drops.resize(p_view->visible_count);
+	job->wind_sample_storage.resize(using_wind_samples ? p_view->visible_count : 0);
+	Vector3 *wind_samples = using_wind_samples ? job->wind_sample_storage.ptr() : NULL;
+
+	uint32_t drop_count = 0;
+	for (uint32_t i = 0; i < count && drop_count < p_view->visible_count; i++) {
+		if ((flags[i] & render_flags) != render_flags)
+			continue;
+
+		if (i >= window_end) {
+			window_base = i;
+			window_end = i + MIN(window_size, count - i);
+			window = &_open_window(view, window_base, window_end, 0);
+		}
+		uint32_t j = i - window_base;
+
+		drops.position_x[drop_count] = window->position_x[j];
+		drops.position_y[drop_count] = window->position_y[j];
+		drops.position_z[drop_count] = window->position_z[j];
+		drops.velocity[drop_count] = window->velocity[j];
+		drops.inv_mass[drop_count] = window->inv_mass[j];
+		drops.hit_height[drop_count] = window->hit_height[j];
+		drops.tex_coord_index[drop_count] = window->tex_coord_index[j];
+		drops.lod_band[drop_count] = window->lod_band[j];
+		if (wind_samples)
+			wind_samples[drop_count] = Vector3(wind_sample_x_write[i], wind_sample_y_write[i], wind_sample_z_write[i]);
+		drop_count++;
+	}
+	drops.resize(drop_count);
+
+	p_view->splash_count = using_splashes ? _count_live_splashes() : 0;
+	uint32_t quad_count = drop_count + p_view->splash_count;
+	bool using_colors = lod_band_count > 1 || p_view->splash_count > 0;
+
+	p_view->back_vertices.resize(quad_count * 4);
+	p_view->back_uvs.resize(quad_count * 4);
+	p_view->back_colors.resize(using_colors ? quad_count * 4 : 0);
+	p_view->back_vertex_write = p_view->back_vertices.write();
+	p_view->back_uv_write = p_view->back_uvs.write();
+	p_view->back_color_write = p_view->back_colors.write();
+	p_view->back_quad_count = quad_count;
+	p_view->back_using_colors = using_colors;
+	p_view->back_pending = true;
+	p_view->back_counts = _get_draw_counts(p_view);
+	p_view->back_counts.visible = drop_count;
+
+	// The worker reads its own reference to the atlas coordinates, which the emitter may rebuild meanwhile.
+	job->coordinate_storage = cached_coordinates;
+	const Vector<Vector2> &coordinates = job->coordinate_storage;
+	_get_quad_params(p_view, using_colors, job->params);
+	job->params.coordinates = coordinates.ptr();
+	job->wind = wind_velocity;
+	job->wind_samples = wind_samples;
+	job->vertices = p_view->back_vertex_write.ptr();
+	job->uvs = p_view->back_uv_write.ptr();
+	job->colors = using_colors ? p_view->back_color_write.ptr() : NULL;
+
+	// Splashes are few enough to build here, after the quads the worker will write.
+	if (p_view->splash_count)
+		_build_splash_quads(p_view, job->vertices + drop_count * 4, job->uvs + drop_count * 4, job->colors + drop_count * 4);
+}
+
+void Precipitation::_finish_mesh_jobs(bool p_present) {
+	mesh_builder.finish_jobs();
+
+	for (int i = 0; i < views.size(); i++) {
+		View *view = views[i];
+		if (!view->back_pending)
+			continue;
+
+		view->back_pending = false;
+		view->back_vertex_write = DVector<Vector3>::Write();
+		view->back_uv_write = DVector<Vector2>::Write();
+		view->back_color_write = DVector<Color>::Write();
+
+		SWAP(view->vertices, view->back_vertices);
+		SWAP(view->uvs, view->back_uvs);
+		SWAP(view->colors, view->back_colors);
+
+		if (p_present) {
+			_present_view(view, view->back_quad_count, view->back_using_colors);
+			view->shown_counts = view->back_counts;
+		}
+	}
+}
+
+template <int BILLBOARDS, int COLORS>
+uint32_t Precipitation::_build_drop_quads(const PrecipitationQuadParams &p_params, Vector3 *r_vertex, Vector2 *r_uv, Color *r_color) {
+	uint32_t count = _get_particle_count();
+	const uint8_t *flags = _get_particle_flags();
+	uint32_t window_size = _get_window_size();
+	PrecipitationParticlePool view;
+	const PrecipitationParticlePool *window = NULL;
+	uint32_t window_base = 0;
+	uint32_t window_end = 0;
+	const uint8_t render_flags = PrecipitationParticlePool::FLAG_VALID | PrecipitationParticlePool::FLAG_RENDER;
+	uint32_t quad_count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if ((flags[i] & render_flags) != render_flags)
+			continue;
+
+		// Windows start at the next drop to draw, so stretches with nothing to draw are never decoded.
+		if (i >= window_end) {
+			window_base = i;
+			window_end = i + MIN(window_size, count - i);
+			window = &_open_window(view, window_base, window_end, 0);
+		}
+		uint32_t j = i - window_base;
+
+		Vector3 pos = Vector3(window->position_x[j], window->position_y[j], window->position_z[j]);
+		precipitation_build_quad<BILLBOARDS, COLORS>(p_params, pos, _get_particle_wind(i), window->inv_mass[j], window->velocity[j], window->hit_height[j], window->tex_coord_index[j], window->lod_band[j], r_vertex, r_uv, r_color);
+
+		r_vertex += 4;
+		r_uv += 4;
+		if (precipitation_feature_enabled<COLORS>(p_params.using_colors))
+			r_color += 4;
+		quad_count++;
+	}
+
+	return quad_count;
+}
+
+void Precipitation::draw_particles_mesh(View *p_view) {
+	p_view->splash_count = using_splashes ? _count_live_splashes() : 0;
+	uint32_t quad_count = p_view->visible_count + p_view->splash_count;
+
+	const bool using_lod = lod_band_count > 1;
+	const bool using_colors = using_lod || p_view->splash_count > 0;
+
+	if (quad_count > 0) {
+		p_view->vertices.resize(quad_count * 4);
+		p_view->uvs.resize(quad_count * 4);
+		p_view->colors.resize(using_colors ? quad_count * 4 : 0);
+
+		PrecipitationQuadParams params;
+		_get_quad_params(p_view, using_colors, params);
+
+		DVector<Vector3>::Write vertex_write = p_view->vertices.write();
+		DVector<Vector2>::Write uv_write = p_view->uvs.write();
+		DVector<Color>::Write color_write = p_view->colors.write();
+		Vector3 *vertex = vertex_write.ptr();
+		Vector2 *uv = uv_write.ptr();
+		Color *color = color_write.ptr();
+
+		uint32_t drop_quads;
+		if (!using_specialized_kernels)
+			drop_quads = _build_drop_quads<PRECIPITATION_FEATURE_DYNAMIC, PRECIPITATION_FEATURE_DYNAMIC>(params, vertex, uv, color);
+		else if (using_billboards && using_colors)
+			drop_quads = _build_drop_quads<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_ON>(params, vertex, uv, color);
+		else if (using_billboards)
+			drop_quads = _build_drop_quads<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_OFF>(params, vertex, uv, color);
+		else if (using_colors)
+			drop_quads = _build_drop_quads<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_ON>(params, vertex, uv, color);
+		else
+			drop_quads = _build_drop_quads<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_OFF>(params, vertex, uv, color);
+
+		// Splashes go in the same surface, after the drops.
+		if (p_view->splash_count)
+			_build_splash_quads(p_view, vertex + drop_quads * 4, uv + drop_quads * 4, color + drop_quads * 4);
+	}
+
+	_present_view(p_view, quad_count, using_colors);
 }
 
 void Precipitation::_bind_methods() {
@@ -348,6 +1817,10 @@ void Precipitation::_bind_methods() {
 
 	ObjectTypeDB::bind_method(_MD("set_wind_velocity", "wind_velocity"), &Precipitation::set_wind_velocity);
 	ObjectTypeDB::bind_method(_MD("get_wind_velocity"), &Precipitation::get_wind_velocity);
+	ObjectTypeDB::bind_method(_MD("set_wind_field", "wind_field:PrecipitationWindField"), &Precipitation::set_wind_field);
+	ObjectTypeDB::bind_method(_MD("get_wind_field:PrecipitationWindField"), &Precipitation::get_wind_field);
+	ObjectTypeDB::bind_method(_MD("set_occlusion_map", "occlusion_map:PrecipitationOcclusionMap"), &Precipitation::set_occlusion_map);
+	ObjectTypeDB::bind_method(_MD("get_occlusion_map:PrecipitationOcclusionMap"), &Precipitation::get_occlusion_map);
 	ObjectTypeDB::bind_method(_MD("set_drop_particle_size", "drop_particle_size"), &Precipitation::set_drop_particle_size);
 	ObjectTypeDB::bind_method(_MD("get_drop_particle_size"), &Precipitation::get_drop_particle_size);
 	ObjectTypeDB::bind_method(_MD("set_using_collision", "using_collision"), &Precipitation::set_using_collision);
@@ -377,12 +1850,89 @@ void Precipitation::_bind_methods() {
 	ObjectTypeDB::bind_method(_MD("set_using_billboards", "using_billboards"), &Precipitation::set_using_billboards);
 	ObjectTypeDB::bind_method(_MD("get_using_billboards"), &Precipitation::get_using_billboards);
 
+	ObjectTypeDB::bind_method(_MD("set_occlusion_cell_size", "occlusion_cell_size"), &Precipitation::set_occlusion_cell_size);
+	ObjectTypeDB::bind_method(_MD("get_occlusion_cell_size"), &Precipitation::get_occlusion_cell_size);
+	ObjectTypeDB::bind_method(_MD("set_raycast_budget", "raycast_budget"), &Precipitation::set_raycast_budget);
+	ObjectTypeDB::bind_method(_MD("get_raycast_budget"), &Precipitation::get_raycast_budget);
+	ObjectTypeDB::bind_method(_MD("set_using_async_collision", "using_async_collision"), &Precipitation::set_using_async_collision);
+	ObjectTypeDB::bind_method(_MD("get_using_async_collision"), &Precipitation::get_using_async_collision);
+
+	ObjectTypeDB::bind_method(_MD("set_simulation_threads", "simulation_threads"), &Precipitation::set_simulation_threads);
+	ObjectTypeDB::bind_method(_MD("get_simulation_threads"), &Precipitation::get_simulation_threads);
+
+	ObjectTypeDB::bind_method(_MD("set_using_compact_storage", "using_compact_storage"), &Precipitation::set_using_compact_storage);
+	ObjectTypeDB::bind_method(_MD("get_using_compact_storage"), &Precipitation::get_using_compact_storage);
+
+	ObjectTypeDB::bind_method(_MD("set_population_ramp_rate", "population_ramp_rate"), &Precipitation::set_population_ramp_rate);
+	ObjectTypeDB::bind_method(_MD("get_population_ramp_rate"), &Precipitation::get_population_ramp_rate);
+
+	ObjectTypeDB::bind_method(_MD("set_using_splashes", "using_splashes"), &Precipitation::set_using_splashes);
+	ObjectTypeDB::bind_method(_MD("get_using_splashes"), &Precipitation::get_using_splashes);
+	ObjectTypeDB::bind_method(_MD("set_splash_capacity", "splash_capacity"), &Precipitation::set_splash_capacity);
+	ObjectTypeDB::bind_method(_MD("get_splash_capacity"), &Precipitation::get_splash_capacity);
+	ObjectTypeDB::bind_method(_MD("set_splash_lifetime", "splash_lifetime"), &Precipitation::set_splash_lifetime);
+	ObjectTypeDB::bind_method(_MD("get_splash_lifetime"), &Precipitation::get_splash_lifetime);
+	ObjectTypeDB::bind_method(_MD("set_splash_size", "splash_size"), &Precipitation::set_splash_size);
+	ObjectTypeDB::bind_method(_MD("get_splash_size"), &Precipitation::get_splash_size);
+	ObjectTypeDB::bind_method(_MD("set_splash_atlas_cell", "splash_atlas_cell"), &Precipitation::set_splash_atlas_cell);
+	ObjectTypeDB::bind_method(_MD("get_splash_atlas_cell"), &Precipitation::get_splash_atlas_cell);
+
+	ObjectTypeDB::bind_method(_MD("set_tile_count", "tile_count"), &Precipitation::set_tile_count);
+	ObjectTypeDB::bind_method(_MD("get_tile_count"), &Precipitation::get_tile_count);
+
+	ObjectTypeDB::bind_method(_MD("set_seed", "seed"), &Precipitation::set_seed);
+	ObjectTypeDB::bind_method(_MD("get_seed"), &Precipitation::get_seed);
+	ObjectTypeDB::bind_method(_MD("save_state:RawArray"), &Precipitation::save_state);
+	ObjectTypeDB::bind_method(_MD("load_state:Error", "state"), &Precipitation::load_state);
+	ObjectTypeDB::bind_method(_MD("prewarm", "seconds"), &Precipitation::prewarm);
+
+	ObjectTypeDB::bind_method(_MD("set_simulation_rate", "simulation_rate"), &Precipitation::set_simulation_rate);
+	ObjectTypeDB::bind_method(_MD("get_simulation_rate"), &Precipitation::get_simulation_rate);
+
+	ObjectTypeDB::bind_method(_MD("set_using_batching", "using_batching"), &Precipitation::set_using_batching);
+	ObjectTypeDB::bind_method(_MD("get_using_batching"), &Precipitation::get_using_batching);
+	ObjectTypeDB::bind_method(_MD("set_using_pipelined_meshes", "using_pipelined_meshes"), &Precipitation::set_using_pipelined_meshes);
+	ObjectTypeDB::bind_method(_MD("get_using_pipelined_meshes"), &Precipitation::get_using_pipelined_meshes);
+	ObjectTypeDB::bind_method(_MD("set_using_specialized_kernels", "using_specialized_kernels"), &Precipitation::set_using_specialized_kernels);
+	ObjectTypeDB::bind_method(_MD("get_using_specialized_kernels"), &Precipitation::get_using_specialized_kernels);
+
+	ObjectTypeDB::bind_method(_MD("set_render_mode", "render_mode"), &Precipitation::set_render_mode);
+	ObjectTypeDB::bind_method(_MD("get_render_mode"), &Precipitation::get_render_mode);
+	ObjectTypeDB::bind_method(_MD("get_procedural_shader_code"), &Precipitation::get_procedural_shader_code);
+
+	ObjectTypeDB::bind_method(_MD("set_max_render_distance", "max_render_distance"), &Precipitation::set_max_render_distance);
+	ObjectTypeDB::bind_method(_MD("get_max_render_distance"), &Precipitation::get_max_render_distance);
+
+	ObjectTypeDB::bind_method(_MD("set_lod_band_distances", "lod_band_distances"), &Precipitation::set_lod_band_distances);
+	ObjectTypeDB::bind_method(_MD("get_lod_band_distances"), &Precipitation::get_lod_band_distances);
+	ObjectTypeDB::bind_method(_MD("set_lod_band_densities", "lod_band_densities"), &Precipitation::set_lod_band_densities);
+	ObjectTypeDB::bind_method(_MD("get_lod_band_densities"), &Precipitation::get_lod_band_densities);
+	ObjectTypeDB::bind_method(_MD("set_lod_band_size_scales", "lod_band_size_scales"), &Precipitation::set_lod_band_size_scales);
+	ObjectTypeDB::bind_method(_MD("get_lod_band_size_scales"), &Precipitation::get_lod_band_size_scales);
+	ObjectTypeDB::bind_method(_MD("get_lod_band_counts"), &Precipitation::get_lod_band_counts);
+
+	ObjectTypeDB::bind_method(_MD("set_stats_enabled", "stats_enabled"), &Precipitation::set_stats_enabled);
+	ObjectTypeDB::bind_method(_MD("is_stats_enabled"), &Precipitation::is_stats_enabled);
+	ObjectTypeDB::bind_method(_MD("get_stat", "stat"), &Precipitation::get_stat);
+	ObjectTypeDB::bind_method(_MD("get_stats"), &Precipitation::get_stats);
+	ObjectTypeDB::bind_method(_MD("reset_stats"), &Precipitation::reset_stats);
+	ObjectTypeDB::bind_method(_MD("set_frame_budget_usec", "frame_budget_usec"), &Precipitation::set_frame_budget_usec);
+	ObjectTypeDB::bind_method(_MD("get_frame_budget_usec"), &Precipitation::get_frame_budget_usec);
+	ObjectTypeDB::bind_method(_MD("get_quality"), &Precipitation::get_quality);
+
+	ObjectTypeDB::bind_method(_MD("add_view", "camera_path", "layer_mask"), &Precipitation::add_view);
+	ObjectTypeDB::bind_method(_MD("remove_view", "camera_path"), &Precipitation::remove_view);
+	ObjectTypeDB::bind_method(_MD("clear_views"), &Precipitation::clear_views);
+	ObjectTypeDB::bind_method(_MD("get_view_count"), &Precipitation::get_view_count);
+
 	ADD_PROPERTY(PropertyInfo(Variant::NODE_PATH, "camera", PROPERTY_HINT_NONE), _SCS("set_camera"), _SCS("get_camera"));
 
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "collision_mask", PROPERTY_HINT_ALL_FLAGS), _SCS("set_collision_mask"), _SCS("get_collision_mask"));
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "visibility_mask", PROPERTY_HINT_ALL_FLAGS), _SCS("set_visibility_mask"), _SCS("get_visibility_mask"));
 
 	ADD_PROPERTY(PropertyInfo(Variant::VECTOR3, "wind_velocity", PROPERTY_HINT_NONE), _SCS("set_wind_velocity"), _SCS("get_wind_velocity"));
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "wind_field", PROPERTY_HINT_RESOURCE_TYPE, "PrecipitationWindField"), _SCS("set_wind_field"), _SCS("get_wind_field"));
+	ADD_PROPERTY(PropertyInfo(Variant::OBJECT, "occlusion_map", PROPERTY_HINT_RESOURCE_TYPE, "PrecipitationOcclusionMap"), _SCS("set_occlusion_map"), _SCS("get_occlusion_map"));
 	ADD_PROPERTY(PropertyInfo(Variant::REAL, "drop_particle_size", PROPERTY_HINT_NONE), _SCS("set_drop_particle_size"), _SCS("get_drop_particle_size"));
 	ADD_PROPERTY(PropertyInfo(Variant::REAL, "percentage", PROPERTY_HINT_NONE), _SCS("set_percentage"), _SCS("get_percentage"));
 	ADD_PROPERTY(PropertyInfo(Variant::_AABB, "box_size", PROPERTY_HINT_NONE), _SCS("set_box_size"), _SCS("get_box_size"));
@@ -397,10 +1947,53 @@ void Precipitation::_bind_methods() {
 
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_collision", PROPERTY_HINT_NONE), _SCS("set_using_collision"), _SCS("get_using_collision"));
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_billboards", PROPERTY_HINT_NONE), _SCS("set_using_billboards"), _SCS("get_using_billboards"));
+
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "occlusion_cell_size", PROPERTY_HINT_NONE), _SCS("set_occlusion_cell_size"), _SCS("get_occlusion_cell_size"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "raycast_budget", PROPERTY_HINT_NONE), _SCS("set_raycast_budget"), _SCS("get_raycast_budget"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_async_collision", PROPERTY_HINT_NONE), _SCS("set_using_async_collision"), _SCS("get_using_async_collision"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "simulation_threads", PROPERTY_HINT_NONE), _SCS("set_simulation_threads"), _SCS("get_simulation_threads"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "simulation_rate", PROPERTY_HINT_NONE), _SCS("set_simulation_rate"), _SCS("get_simulation_rate"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_compact_storage", PROPERTY_HINT_NONE), _SCS("set_using_compact_storage"), _SCS("get_using_compact_storage"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "seed", PROPERTY_HINT_NONE), _SCS("set_seed"), _SCS("get_seed"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "tile_count", PROPERTY_HINT_NONE), _SCS("set_tile_count"), _SCS("get_tile_count"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_splashes", PROPERTY_HINT_NONE), _SCS("set_using_splashes"), _SCS("get_using_splashes"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "splash_capacity", PROPERTY_HINT_NONE), _SCS("set_splash_capacity"), _SCS("get_splash_capacity"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "splash_lifetime", PROPERTY_HINT_NONE), _SCS("set_splash_lifetime"), _SCS("get_splash_lifetime"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "splash_size", PROPERTY_HINT_NONE), _SCS("set_splash_size"), _SCS("get_splash_size"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "splash_atlas_cell", PROPERTY_HINT_NONE), _SCS("set_splash_atlas_cell"), _SCS("get_splash_atlas_cell"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "population_ramp_rate", PROPERTY_HINT_NONE), _SCS("set_population_ramp_rate"), _SCS("get_population_ramp_rate"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "render_mode", PROPERTY_HINT_ENUM, "Immediate,Mesh,Procedural"), _SCS("set_render_mode"), _SCS("get_render_mode"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_batching", PROPERTY_HINT_NONE), _SCS("set_using_batching"), _SCS("get_using_batching"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_pipelined_meshes", PROPERTY_HINT_NONE), _SCS("set_using_pipelined_meshes"), _SCS("get_using_pipelined_meshes"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "using_specialized_kernels", PROPERTY_HINT_NONE), _SCS("set_using_specialized_kernels"), _SCS("get_using_specialized_kernels"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL, "max_render_distance", PROPERTY_HINT_NONE), _SCS("set_max_render_distance"), _SCS("get_max_render_distance"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL_ARRAY, "lod_band_distances", PROPERTY_HINT_NONE), _SCS("set_lod_band_distances"), _SCS("get_lod_band_distances"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL_ARRAY, "lod_band_densities", PROPERTY_HINT_NONE), _SCS("set_lod_band_densities"), _SCS("get_lod_band_densities"));
+	ADD_PROPERTY(PropertyInfo(Variant::REAL_ARRAY, "lod_band_size_scales", PROPERTY_HINT_NONE), _SCS("set_lod_band_size_scales"), _SCS("get_lod_band_size_scales"));
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "stats_enabled", PROPERTY_HINT_NONE), _SCS("set_stats_enabled"), _SCS("is_stats_enabled"));
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "frame_budget_usec", PROPERTY_HINT_NONE), _SCS("set_frame_budget_usec"), _SCS("get_frame_budget_usec"));
+
+	// Sent when the governor first thins the drops to stay within frame_budget_usec, and when it is back at full quality.
+	ADD_SIGNAL(MethodInfo("quality_degraded", PropertyInfo(Variant::REAL, "quality")));
+	ADD_SIGNAL(MethodInfo("quality_restored"));
+
+	BIND_CONSTANT(RENDER_MODE_IMMEDIATE);
+	BIND_CONSTANT(RENDER_MODE_MESH);
+	BIND_CONSTANT(RENDER_MODE_PROCEDURAL);
+
+	BIND_CONSTANT(STAT_SIMULATE_USEC);
+	BIND_CONSTANT(STAT_CUTOFF_USEC);
+	BIND_CONSTANT(STAT_DRAW_USEC);
+	BIND_CONSTANT(STAT_RAYCASTS);
+	BIND_CONSTANT(STAT_PARTICLES_LIVE);
+	BIND_CONSTANT(STAT_PARTICLES_VALID);
+	BIND_CONSTANT(STAT_PARTICLES_RENDERED);
+	BIND_CONSTANT(STAT_VERTICES);
 }
 
 Precipitation::Precipitation() {
-	immediate_geometry = NULL;
+	// The primary view, driven by the camera and visibility_mask properties.
+	add_view(NodePath(), 1);
 
 	collision_mask = 1;
 	visibility_mask = 1;
@@ -421,8 +2014,50 @@ Precipitation::Precipitation() {
 	using_collision = true;
 	using_billboards = false;
 
-	particle_head = NULL;
+	occlusion_cell_size = 0.5;
+	raycast_budget = 256;
+	using_async_collision = false;
+
+	simulation_threads = 1;
+	simulation_rate = 0;
+	population_ramp_rate = 0;
+	using_compact_storage = false;
+
+	tile_count = 0;
+
+	using_splashes = false;
+	splash_lifetime = 0.2;
+	splash_size = 0.15;
+	splash_atlas_cell = 0;
+	set_splash_capacity(256);
+
+	render_mode = RENDER_MODE_IMMEDIATE;
+	using_batching = false;
+	using_pipelined_meshes = false;
+	using_specialized_kernels = true;
+
+	max_render_distance = 0;
+
+	_update_lod_bands();
+
+	stats_enabled = false;
+	reset_stats();
+	frame_budget_usec = 0;
 }
 
 Precipitation::~Precipitation() {
+	_finish_mesh_jobs(false);
+
+	// The view nodes are children and go with the tree.
+	for (int i = 0; i < views.size(); i++) {
+		memdelete(views[i]);
+	}
+
+	for (int i = 0; i < compact_scratch.size(); i++) {
+		memdelete(compact_scratch[i]);
+	}
+
+	if (worker_pool)
+		memdelete(worker_pool);
+	empty_particles();
 }
\ No newline at end of file
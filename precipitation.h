@@ -4,29 +4,58 @@
 #include "scene/3d/spatial.h"
 #include "scene/3d/camera.h"
 #include "scene/3d/immediate_geometry.h"
-
-// TODO: create a new render primitive which calls into a custom rendering method every camera pass to allow this
-// effect to be rendered differently for every camera/viewport.
+#include "scene/3d/mesh_instance.h"
+#include "precipitation_particle_pool.h"
+#include "precipitation_compact_pool.h"
+#include "precipitation_occlusion_cache.h"
+#include "precipitation_occlusion_map.h"
+#include "precipitation_async_collision.h"
+#include "precipitation_kernels.h"
+#include "precipitation_mesh_builder.h"
+#include "precipitation_worker_pool.h"
+#include "precipitation_procedural.h"
+#include "precipitation_random.h"
+#include "precipitation_splash_pool.h"
+#include "precipitation_wind_field.h"
 
 class Precipitation : public Spatial {
 
 	OBJ_TYPE(Precipitation,Spatial);
 	OBJ_SAVE_TYPE(Precipitation);
+
+	friend class PrecipitationBenchmark;
+public:
+	enum RenderMode {
+		RENDER_MODE_IMMEDIATE,
+		RENDER_MODE_MESH,
+		RENDER_MODE_PROCEDURAL,
+	};
+
+	enum Stat {
+		STAT_SIMULATE_USEC,
+		STAT_CUTOFF_USEC,
+		STAT_DRAW_USEC,
+		STAT_RAYCASTS,
+		STAT_PARTICLES_LIVE,
+		STAT_PARTICLES_VALID,
+		STAT_PARTICLES_RENDERED,
+		STAT_VERTICES,
+		STAT_MAX
+	};
+
 protected:
-	class Particle {
-	public:
-		Vector3 position;
-		Vector3 render_position;
-		Vector3 hit_pos;
-		float velocity;
-		float time;
-		float mass;
-		float anim_start_time;
-		uint32_t tex_coord_index;
-
-		bool is_valid;
-		bool to_render;
-		Particle *next = NULL;
+	enum {
+		// Fixed so the split, and with it the order cutoff requests are resolved in, does not depend
+		// on how many threads are simulating.
+		SIMULATION_CHUNK_SIZE = 16384,
+		// Speeds and wind are given per step at this rate, whatever rate the simulation runs at.
+		SIMULATION_REFERENCE_RATE = 60,
+		// Most simulation steps taken in one fixed tick when catching up.
+		MAX_STEPS_PER_TICK = 4,
+		// Ticks the rolling statistics are kept over.
+		STATS_WINDOW = 120,
+		// Drops decoded at a time in compact storage mode, few enough for the floats to stay in cache.
+		COMPACT_WINDOW_SIZE = 1024
 	};
 
 	NodePath camera_path = NodePath();
@@ -34,6 +63,8 @@ protected:
 	uint32_t collision_mask;
 	uint32_t visibility_mask;
 	Vector3 wind_velocity;
+	Ref<PrecipitationWindField> wind_field;
+	Ref<PrecipitationOcclusionMap> occlusion_map;
 
 	Ref<Material> drop_particle_material;
 	float drop_particle_size;
@@ -41,6 +72,9 @@ protected:
 	float percentage;
 	Vector2 box_size;
 	int max_particles;
+	// Drops added or removed per second on the way to max_particles * percentage; zero jumps straight there.
+	float population_ramp_rate;
+	float population_carry = 0;
 	int drops_per_texture;
 
 	float min_speed;
@@ -51,38 +85,321 @@ protected:
 	bool using_collision;
 	bool using_billboards;
 
+	float occlusion_cell_size;
+	int raycast_budget;
+	// Resolves the occlusion rays on a background thread against a snapshot of the static geometry.
+	bool using_async_collision;
+
+	int simulation_threads;
+	// Steps per second; zero steps once every fixed tick.
+	float simulation_rate;
+	float simulation_time = 0;
+	float last_step_time = 0;
+	// Time since the last step, advanced at display rate so drawing can move the drops on between steps.
+	float render_time = 0;
+	float render_offset = 0;
+
+	RenderMode render_mode;
+
+	float max_render_distance;
+
+	DVector<real_t> lod_band_distances;
+	DVector<real_t> lod_band_densities;
+	DVector<real_t> lod_band_size_scales;
+
 //
-	ImmediateGeometry *immediate_geometry = NULL;
+	// What one view's geometry holds, for the counters and get_lod_band_counts.
+	struct DrawCounts {
+		uint32_t visible;
+		uint32_t splashes;
+		uint32_t lod_band_visible[PrecipitationCullParams::MAX_LOD_BANDS];
+	};
+
+	// A camera the shared simulation is drawn for. Every view culls and builds its own geometry, which is only
+	// shown on the view's layers so each camera's visible layers pick out its own copy. The first view belongs
+	// to the camera property and uses visibility_mask; it also places the simulation box.
+	struct View {
+		NodePath camera_path;
+		Camera *camera;
+		uint32_t layer_mask;
+
+		ImmediateGeometry *immediate_geometry;
+		MeshInstance *mesh_instance;
+		Ref<Mesh> mesh;
+		DVector<Vector3> vertices;
+		DVector<Vector2> uvs;
+		DVector<Color> colors;
+		DVector<int> indices;
+
+		uint32_t visible_count;
+		uint32_t splash_count;
+		uint32_t lod_band_visible[PrecipitationCullParams::MAX_LOD_BANDS];
+		// The counts of the geometry on screen, which with pipelined meshes is the previous cull's.
+		DrawCounts shown_counts;
+
+		// With pipelined meshes, the arrays the mesh builder is filling for the next frame, locked until it
+		// is done, while the ones above are drawn.
+		DVector<Vector3> back_vertices;
+		DVector<Vector2> back_uvs;
+		DVector<Color> back_colors;
+		DVector<Vector3>::Write back_vertex_write;
+		DVector<Vector2>::Write back_uv_write;
+		DVector<Color>::Write back_color_write;
+		uint32_t back_quad_count;
+		bool back_using_colors;
+		bool back_pending;
+		DrawCounts back_counts;
+	};
+
+	Vector<View *> views;
+
+	// Hands the quads to PrecipitationBatcher, to be drawn with every other batching emitter, instead of
+	// drawing them with the views' own nodes.
+	bool using_batching;
+
+	Camera *_find_camera(const NodePath &p_path) const;
+	void _create_view_nodes(View *p_view);
+	void _free_view_nodes(View *p_view);
+
+	// Builds the quads of mesh and batched drawing on a background thread, a frame late: each draw shows the
+	// quads started by the previous one, then gathers this frame's drops for the worker.
+	bool using_pipelined_meshes;
+	PrecipitationMeshBuilder mesh_builder;
+
+	_FORCE_INLINE_ bool _is_pipelining() const {
+		return using_pipelined_meshes && (render_mode == RENDER_MODE_MESH || (render_mode == RENDER_MODE_IMMEDIATE && using_batching));
+	}
+
+	void _get_quad_params(View *p_view, bool p_using_colors, PrecipitationQuadParams &r_params) const;
+	// Builds the quads of the drops to draw, in pool order, and returns how many were written.
+	template <int BILLBOARDS, int COLORS>
+	uint32_t _build_drop_quads(const PrecipitationQuadParams &p_params, Vector3 *r_vertex, Vector2 *r_uv, Color *r_color);
+	template <int BILLBOARDS, int COLORS>
+	void _add_immediate_drops(View *p_view, const PrecipitationQuadParams &p_params);
+	void _build_splash_quads(View *p_view, Vector3 *r_vertex, Vector2 *r_uv, Color *r_color) const;
+	void _present_view(View *p_view, uint32_t p_quad_count, bool p_using_colors);
+	void _queue_mesh_job(View *p_view);
+	// Waits for the quads in flight and swaps them in, drawing them if p_present is set.
+	void _finish_mesh_jobs(bool p_present);
+
+	MeshInstance *procedural_instance = NULL;
+	Ref<Mesh> procedural_mesh;
+	float procedural_steps = 0;
+	bool procedural_material_warned = false;
+
+	void _clear_mesh(const Ref<Mesh> &p_mesh);
+	void _update_procedural_mesh();
+	void _update_procedural(ShaderMaterial *p_shader_material, const float p_delta);
 
 	AABB visibility_box;
+	// Tiles per side of the box in world-space tile mode; zero keeps the box centred on the camera.
+	int tile_count;
+	Vector3 tile_origin;
+	bool tile_valid = false;
+
+	void _update_visibility_box();
 	Ref<World> w3d = NULL;
 	PhysicsDirectSpaceState *dss = NULL;
 	Camera *camera_node = NULL;
 
 	bool pending_update = false;
-	Particle *particle_head;
+	PrecipitationParticlePool particles;
+
+	// In compact storage mode the drops live here instead, and every pass decodes them a window at a time
+	// into a scratch pool per thread. Positions are decoded into the box of the last step.
+	bool using_compact_storage;
+	PrecipitationCompactPool compact_particles;
+	PrecipitationCompactPool::Frame compact_frame;
+	PrecipitationCompactPool::Frame compact_step_frame;
+	Vector<PrecipitationParticlePool *> compact_scratch;
+
+	void _update_compact_scratch();
+	PrecipitationParticlePool &_open_window(PrecipitationParticlePool &r_view, uint32_t p_from, uint32_t p_to, uint32_t p_thread);
+
+	_FORCE_INLINE_ uint32_t _get_window_size() const {
+		return using_compact_storage ? (uint32_t)COMPACT_WINDOW_SIZE : 0xFFFFFFFF;
+	}
+
+	_FORCE_INLINE_ uint32_t _get_particle_count() const {
+		return using_compact_storage ? compact_particles.size() : particles.size();
+	}
+
+	_FORCE_INLINE_ uint8_t *_get_particle_flags() const {
+		return using_compact_storage ? compact_particles.flags : particles.flags;
+	}
+
+	_FORCE_INLINE_ Vector3 _get_particle_position(uint32_t p_index) const {
+		if (using_compact_storage)
+			return compact_particles.get_position(p_index, compact_frame);
+		return Vector3(particles.position_x[p_index], particles.position_y[p_index], particles.position_z[p_index]);
+	}
+
+	_FORCE_INLINE_ float _get_particle_hit_height(uint32_t p_index) const {
+		if (using_compact_storage)
+			return compact_particles.get_hit_height(p_index, compact_frame);
+		return particles.hit_height[p_index];
+	}
+
+	_FORCE_INLINE_ void _set_particle_hit_height(uint32_t p_index, float p_height) {
+		if (using_compact_storage)
+			compact_particles.set_hit_height(p_index, p_height, compact_frame);
+		else
+			particles.hit_height[p_index] = p_height;
+	}
+
+	// One per-drop array of the current storage, as save_state() lays them out.
+	struct StateArray {
+		void *data;
+		uint32_t element_size;
+	};
+
+	enum {
+		MAX_STATE_ARRAYS = 9
+	};
+
+	int _get_state_arrays(StateArray *r_arrays) const;
+
 	Vector<Vector2> cached_coordinates;
+	Vector<uint32_t> wrapped_indices;
+
+	PrecipitationRandom random;
+	Vector<uint32_t> respawn_indices;
+	Vector<float> spawn_values;
+	Vector<uint32_t> spawn_tex_coords;
+
+	// Moves the drops whose atlas cell is past the end of the current atlas back onto it.
+	void _fold_tex_coords();
+
+	PrecipitationWorkerPool *worker_pool = NULL;
+	PrecipitationStepParams step_params;
+	Vector<uint32_t> chunk_wrapped_counts;
+	uint32_t *chunk_wrapped_write = NULL;
+	uint32_t *wrapped_write = NULL;
+	Vector<uint32_t> impact_indices;
+	Vector<uint32_t> chunk_impact_counts;
+	uint32_t *chunk_impact_write = NULL;
+	uint32_t *impact_write = NULL;
+
+	// Each drop's wind field sample from its last step, indexed like the pool and sized to its capacity.
+	bool using_wind_samples = false;
+	Vector<float> wind_sample_x;
+	Vector<float> wind_sample_y;
+	Vector<float> wind_sample_z;
+	float *wind_sample_x_write = NULL;
+	float *wind_sample_y_write = NULL;
+	float *wind_sample_z_write = NULL;
+	float wind_sample_scale = 0;
+
+	// Follows the wind field and the pool's capacity, so drawing and cutoffs between steps stay in bounds.
+	void _update_wind_samples();
+
+	_FORCE_INLINE_ Vector3 _get_particle_wind(uint32_t p_index) const {
+		if (!using_wind_samples)
+			return wind_velocity;
+		return wind_velocity + Vector3(wind_sample_x_write[p_index], wind_sample_y_write[p_index], wind_sample_z_write[p_index]);
+	}
+
+	bool using_splashes;
+	int splash_capacity;
+	float splash_lifetime;
+	float splash_size;
+	int splash_atlas_cell;
+	PrecipitationSplashPool splashes;
+	// Seconds the drawn splashes are aged past the last step.
+	float splash_age_offset = 0;
+
+	uint32_t _count_live_splashes() const;
+	bool _get_splash_corners(uint32_t p_index, const Vector3 &p_side, Vector3 *r_corners, float &r_alpha) const;
+
+	PrecipitationCullParams cull_params;
+	// Picked each draw to match cull_params' distance limit and bands.
+	PrecipitationCullFunction cull_function = precipitation_cull;
+	Vector<uint32_t> chunk_visible_counts;
+	uint32_t *chunk_visible_write = NULL;
+
+	int lod_band_count = 1;
+	float lod_band_scale[PrecipitationCullParams::MAX_LOD_BANDS];
+	float lod_band_alpha[PrecipitationCullParams::MAX_LOD_BANDS];
+
+	void _update_lod_bands();
+
+	static void _simulate_chunk(void *p_self, uint32_t p_chunk, uint32_t p_thread);
+	static void _cull_chunk(void *p_self, uint32_t p_chunk, uint32_t p_thread);
+	void _cull_particles(View *p_view);
+	static DrawCounts _get_draw_counts(const View *p_view);
+
+	PrecipitationOcclusionCache occlusion_cache;
+	PrecipitationAsyncCollision async_collision;
+	// Everything the occlusion rays of the current box can reach.
+	AABB occlusion_bounds;
+	Vector<uint32_t> pending_cutoffs;
+
+	void _update_occlusion_cache();
+	void _resolve_pending_cutoffs();
+
+	// Per-tick instrumentation. Nothing is measured, beyond a branch per phase, while it is disabled.
+	bool stats_enabled;
+	float stats_current[STAT_MAX];
+	float stats_history[STAT_MAX][STATS_WINDOW];
+	int stats_frame = 0;
+	int stats_recorded = 0;
+	bool stats_frame_open = false;
+
+	uint64_t _stats_ticks() const;
+	void _stats_next_frame();
+
+	// Scales the population and the raycast budget so the time this emitter takes per frame, simulating,
+	// resolving cutoffs and drawing, stays under frame_budget_usec. Zero turns it off.
+	int frame_budget_usec;
+	float governor_quality = 1;
+	// Smoothed cost of a frame, and what the current one has cost so far.
+	float governor_cost = 0;
+	uint64_t governor_frame_usec = 0;
+
+	void _update_governor(const float p_delta);
+
+	_FORCE_INLINE_ int _get_governed_raycast_budget() const {
+		return raycast_budget > 0 ? MAX((int)(raycast_budget * governor_quality), 1) : 0;
+	}
+
+	// The inner loops are instantiated for each combination of the settings they test, and a dispatcher picks
+	// one per pass; without this every pass runs the generic instantiation, which tests them per drop.
+	bool using_specialized_kernels;
+
+	template <int COLLISION>
+	void _calculate_cutoff_point(uint32_t p_index, const Vector3 &p_wind_velocity);
+	template <int COLLISION>
+	void _calculate_cutoff_points(const uint32_t *p_indices, uint32_t p_count);
+	// calculate_particle_cutoff_point() for each of p_indices, with the collision setting compiled in.
+	void _dispatch_cutoff_points(const uint32_t *p_indices, uint32_t p_count);
 
 public:
-	void calculate_particle_cutoff_point(Precipitation::Particle *p_particle, const AABB &p_box, const Vector3 &p_wind_velocity);
-	void spawn_particle(Precipitation::Particle *p_particle, const float p_delta);
-	void spawn_new_particle(Precipitation::Particle *p_particle, const float p_delta);
+	void calculate_particle_cutoff_point(uint32_t p_index, const AABB &p_box, const Vector3 &p_wind_velocity);
+	void spawn_particles(uint32_t p_from, uint32_t p_to);
+	void respawn_particles(const uint32_t *p_indices, uint32_t p_count);
 	void empty_particles();
 	void populate_particles(const float p_delta);
 
-	void wrap_particle(Particle *p_particle, AABB &p_box, Vector3 &p_wind_velocity, const float p_delta);
+	// The drops with their cutoffs, the box and the generator, so a restored emitter carries on where this one
+	// was. Splashes and the occlusion cache are not kept. The blob is in the machine's byte order and only
+	// loads into an emitter with the same storage mode.
+	DVector<uint8_t> save_state() const;
+	Error load_state(const DVector<uint8_t> &p_state);
+	// Simulates p_seconds straight away, without drawing, so the weather starts settled. Needs the camera and,
+	// with collision, the node in the tree and ready.
+	void prewarm(const float p_seconds);
+
 	void update_render_cache();
 	void draw_particles();
+	void draw_particles_immediate(View *p_view);
+	void draw_particles_mesh(View *p_view);
 	void _precipitation_process(const float p_delta);
 
 	_FORCE_INLINE_ void set_camera(const NodePath &p_nodepath) {
 		camera_path = p_nodepath;
-		if (has_node(camera_path)) {
-			camera_node = static_cast<Camera *>(get_node(camera_path));
-		}
-		else {
-			camera_node = NULL;
-		}
+		camera_node = _find_camera(camera_path);
+		views[0]->camera_path = camera_path;
+		views[0]->camera = camera_node;
 	}
 
 	_FORCE_INLINE_ NodePath get_camera() const {
@@ -99,8 +416,15 @@ public:
 
 	_FORCE_INLINE_ void set_visibility_mask(const int p_visibility_mask) {
 		visibility_mask = p_visibility_mask;
-		if (immediate_geometry != NULL) {
-			immediate_geometry->set_layer_mask(visibility_mask);
+		views[0]->layer_mask = visibility_mask;
+		if (views[0]->immediate_geometry != NULL) {
+			views[0]->immediate_geometry->set_layer_mask(visibility_mask);
+		}
+		if (views[0]->mesh_instance != NULL) {
+			views[0]->mesh_instance->set_layer_mask(visibility_mask);
+		}
+		if (procedural_instance != NULL) {
+			procedural_instance->set_layer_mask(visibility_mask);
 		}
 	}
 
@@ -116,6 +440,22 @@ public:
 		return wind_velocity;
 	}
 
+	// Added to wind_velocity where each drop is. The procedural render mode only uses wind_velocity.
+	void set_wind_field(const Ref<PrecipitationWindField> &p_wind_field);
+
+	_FORCE_INLINE_ Ref<PrecipitationWindField> get_wind_field() const {
+		return wind_field;
+	}
+
+	// Baked cutoffs for the static level; drops inside it need no raycasts, the rest go through the cache.
+	_FORCE_INLINE_ void set_occlusion_map(const Ref<PrecipitationOcclusionMap> &p_occlusion_map) {
+		occlusion_map = p_occlusion_map;
+	}
+
+	_FORCE_INLINE_ Ref<PrecipitationOcclusionMap> get_occlusion_map() const {
+		return occlusion_map;
+	}
+
 	_FORCE_INLINE_ void set_drop_particle_size(const float p_drop_particle_size) {
 		drop_particle_size = p_drop_particle_size;
 	}
@@ -126,6 +466,9 @@ public:
 
 	_FORCE_INLINE_ void set_percentage(const float p_percentage) {
 		percentage = p_percentage;
+		// The simulated population follows the percentage on its own; the procedural mesh has to be rebuilt.
+		if (render_mode == RENDER_MODE_PROCEDURAL)
+			pending_update = true;
 	}
 
 	_FORCE_INLINE_ float get_percentage() const {
@@ -142,7 +485,9 @@ public:
 
 	_FORCE_INLINE_ void set_max_particles(const int p_max_particles) {
 		max_particles = p_max_particles;
-		pending_update = true;
+		// Like the percentage, only the procedural mesh has to be rebuilt; the pool just moves its watermark.
+		if (render_mode == RENDER_MODE_PROCEDURAL)
+			pending_update = true;
 	}
 
 	_FORCE_INLINE_ int get_max_particles() const {
@@ -158,11 +503,7 @@ public:
 		return drops_per_texture;
 	}
 
-	_FORCE_INLINE_ void set_drop_particle_material(Ref<Material> p_material) {
-		drop_particle_material = p_material;
-		if (immediate_geometry != NULL)
-			immediate_geometry->set_material_override(drop_particle_material);
-	}
+	void set_drop_particle_material(Ref<Material> p_material);
 
 	_FORCE_INLINE_ Ref<Material>get_drop_particle_material() const {
 		return drop_particle_material;
@@ -216,6 +557,214 @@ public:
 		return using_billboards;
 	}
 
+	_FORCE_INLINE_ void set_occlusion_cell_size(const float p_occlusion_cell_size) {
+		occlusion_cell_size = MAX(p_occlusion_cell_size, 0.01);
+	}
+
+	_FORCE_INLINE_ float get_occlusion_cell_size() const {
+		return occlusion_cell_size;
+	}
+
+	_FORCE_INLINE_ void set_raycast_budget(const int p_raycast_budget) {
+		raycast_budget = MAX(p_raycast_budget, 0);
+	}
+
+	_FORCE_INLINE_ int get_raycast_budget() const {
+		return raycast_budget;
+	}
+
+	// Static geometry is captured when the box leaves the captured area, and again each time this is set.
+	_FORCE_INLINE_ void set_using_async_collision(const bool p_using_async_collision) {
+		using_async_collision = p_using_async_collision;
+		async_collision.invalidate();
+	}
+
+	_FORCE_INLINE_ bool get_using_async_collision() const {
+		return using_async_collision;
+	}
+
+	void set_simulation_threads(const int p_simulation_threads);
+
+	_FORCE_INLINE_ int get_simulation_threads() const {
+		return simulation_threads;
+	}
+
+	// Switching storage drops the current population, which then refills like a fresh one.
+	void set_using_compact_storage(const bool p_using_compact_storage);
+
+	_FORCE_INLINE_ bool get_using_compact_storage() const {
+		return using_compact_storage;
+	}
+
+	_FORCE_INLINE_ void set_population_ramp_rate(const float p_population_ramp_rate) {
+		population_ramp_rate = MAX(p_population_ramp_rate, 0.0);
+	}
+
+	_FORCE_INLINE_ float get_population_ramp_rate() const {
+		return population_ramp_rate;
+	}
+
+	_FORCE_INLINE_ void set_using_splashes(const bool p_using_splashes) {
+		using_splashes = p_using_splashes;
+		splashes.clear();
+	}
+
+	_FORCE_INLINE_ bool get_using_splashes() const {
+		return using_splashes;
+	}
+
+	_FORCE_INLINE_ void set_splash_capacity(const int p_splash_capacity) {
+		splash_capacity = MAX(p_splash_capacity, 0);
+		splashes.set_capacity(splash_capacity);
+	}
+
+	_FORCE_INLINE_ int get_splash_capacity() const {
+		return splash_capacity;
+	}
+
+	_FORCE_INLINE_ void set_splash_lifetime(const float p_splash_lifetime) {
+		splash_lifetime = MAX(p_splash_lifetime, 0.001);
+	}
+
+	_FORCE_INLINE_ float get_splash_lifetime() const {
+		return splash_lifetime;
+	}
+
+	_FORCE_INLINE_ void set_splash_size(const float p_splash_size) {
+		splash_size = p_splash_size;
+	}
+
+	_FORCE_INLINE_ float get_splash_size() const {
+		return splash_size;
+	}
+
+	_FORCE_INLINE_ void set_splash_atlas_cell(const int p_splash_atlas_cell) {
+		splash_atlas_cell = MAX(p_splash_atlas_cell, 0);
+	}
+
+	_FORCE_INLINE_ int get_splash_atlas_cell() const {
+		return splash_atlas_cell;
+	}
+
+	// The box trails the camera by up to a tile and a quarter before it moves, so it should be sized with that
+	// margin around the visible range. Counts below three are raised to three; zero turns tiling off.
+	_FORCE_INLINE_ void set_tile_count(const int p_tile_count) {
+		tile_count = p_tile_count > 0 ? MAX(p_tile_count, 3) : 0;
+		tile_valid = false;
+	}
+
+	_FORCE_INLINE_ int get_tile_count() const {
+		return tile_count;
+	}
+
+	// Restarts the spawn sequence, so the same seed and settings replay the same drops.
+	_FORCE_INLINE_ void set_seed(const int p_seed) {
+		random.set_seed(p_seed);
+	}
+
+	_FORCE_INLINE_ int get_seed() const {
+		return random.get_seed();
+	}
+
+	_FORCE_INLINE_ void set_simulation_rate(const float p_simulation_rate) {
+		simulation_rate = MAX(p_simulation_rate, 0.0);
+		simulation_time = 0;
+	}
+
+	_FORCE_INLINE_ float get_simulation_rate() const {
+		return simulation_rate;
+	}
+
+	// Batched emitters build their quads as arrays whatever the render mode; the procedural mode is not batched.
+	void set_using_batching(const bool p_using_batching);
+
+	_FORCE_INLINE_ bool get_using_batching() const {
+		return using_batching;
+	}
+
+	// Only the mesh mode and batched drawing are pipelined; immediate geometry has to be built on the main thread.
+	void set_using_pipelined_meshes(const bool p_using_pipelined_meshes);
+
+	_FORCE_INLINE_ bool get_using_pipelined_meshes() const {
+		return using_pipelined_meshes;
+	}
+
+	_FORCE_INLINE_ void set_using_specialized_kernels(const bool p_using_specialized_kernels) {
+		using_specialized_kernels = p_using_specialized_kernels;
+	}
+
+	_FORCE_INLINE_ bool get_using_specialized_kernels() const {
+		return using_specialized_kernels;
+	}
+
+	void set_render_mode(const RenderMode p_render_mode);
+
+	_FORCE_INLINE_ RenderMode get_render_mode() const {
+		return render_mode;
+	}
+
+	String get_procedural_shader_code() const;
+
+	_FORCE_INLINE_ void set_max_render_distance(const float p_max_render_distance) {
+		max_render_distance = MAX(p_max_render_distance, 0.0);
+	}
+
+	_FORCE_INLINE_ float get_max_render_distance() const {
+		return max_render_distance;
+	}
+
+	_FORCE_INLINE_ void set_lod_band_distances(const DVector<real_t> &p_lod_band_distances) {
+		lod_band_distances = p_lod_band_distances;
+	}
+
+	_FORCE_INLINE_ DVector<real_t> get_lod_band_distances() const {
+		return lod_band_distances;
+	}
+
+	_FORCE_INLINE_ void set_lod_band_densities(const DVector<real_t> &p_lod_band_densities) {
+		lod_band_densities = p_lod_band_densities;
+	}
+
+	_FORCE_INLINE_ DVector<real_t> get_lod_band_densities() const {
+		return lod_band_densities;
+	}
+
+	_FORCE_INLINE_ void set_lod_band_size_scales(const DVector<real_t> &p_lod_band_size_scales) {
+		lod_band_size_scales = p_lod_band_size_scales;
+	}
+
+	_FORCE_INLINE_ DVector<real_t> get_lod_band_size_scales() const {
+		return lod_band_size_scales;
+	}
+
+	DVector<int> get_lod_band_counts() const;
+
+	void set_stats_enabled(const bool p_stats_enabled);
+
+	_FORCE_INLINE_ bool is_stats_enabled() const {
+		return stats_enabled;
+	}
+
+	float get_stat(Stat p_stat) const;
+	Dictionary get_stats() const;
+	void reset_stats();
+
+	void set_frame_budget_usec(const int p_frame_budget_usec);
+
+	_FORCE_INLINE_ int get_frame_budget_usec() const {
+		return frame_budget_usec;
+	}
+
+	// Fraction of max_particles * percentage and of raycast_budget the governor currently allows.
+	_FORCE_INLINE_ float get_quality() const {
+		return governor_quality;
+	}
+
+	void add_view(const NodePath &p_camera, int p_layer_mask);
+	void remove_view(const NodePath &p_camera);
+	void clear_views();
+	int get_view_count() const;
+
 	void _notification(int p_what);
 	static void _bind_methods();
 public:
@@ -223,5 +772,7 @@ public:
 	~Precipitation();
 };
 
+VARIANT_ENUM_CAST(Precipitation::RenderMode);
+VARIANT_ENUM_CAST(Precipitation::Stat);
 
 #endif // PRECIPITATION_H
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "precipitation_async_collision.h"
+
+void PrecipitationAsyncCollision::_thread_func(void *p_self) {
+	PrecipitationAsyncCollision *self = (PrecipitationAsyncCollision *)p_self;
+
+	while (true) {
+		self->start->wait();
+		if (self->exit)
+			break;
+
+		for (int i = 0; i < self->batch_size; i++) {
+			PrecipitationOcclusionCache::RayRequest &request = self->batch_requests[i];
+
+			Vector3 position;
+			if (self->snapshot.intersect_segment(request.from, request.to, position))
+				request.height = position.y;
+			else
+				request.height = PrecipitationOcclusionCache::EMPTY_HEIGHT;
+		}
+
+		self->finished->post();
+	}
+}
+
+int PrecipitationAsyncCollision::process(PrecipitationOcclusionCache &p_cache, PhysicsDirectSpaceState *p_space, const AABB &p_bounds, uint32_t p_collision_mask, int p_batch_size) {
+	int applied = 0;
+
+	if (running) {
+		if (finished->get() == 0)
+			return 0;
+
+		finished->wait();
+		running = false;
+
+		p_cache.apply_results(batch_requests, batch_size);
+		applied = batch_size;
+	}
+
+	if (p_cache.get_queued_count() == 0 || p_batch_size <= 0)
+		return applied;
+
+	if (snapshot_dirty || !snapshot.covers(p_bounds, p_collision_mask)) {
+		// Capture half a box of margin around the area so ordinary camera movement reuses the snapshot.
+		float margin = MAX(p_bounds.size.x, p_bounds.size.z) * 0.5;
+		AABB area = p_bounds;
+		area.pos -= Vector3(margin, 1, margin);
+		area.size += Vector3(margin, 1, margin) * 2;
+
+		snapshot.capture(p_space, area, p_collision_mask, Set<RID>());
+		snapshot_dirty = false;
+	}
+
+	if (batch.size() < p_batch_size)
+		batch.resize(p_batch_size);
+	batch_requests = batch.ptr();
+	batch_size = p_cache.dequeue_requests(batch_requests, p_batch_size);
+
+	if (batch_size > 0) {
+		if (thread == NULL)
+			thread = Thread::create(_thread_func, this);
+
+		running = true;
+		start->post();
+	}
+
+	return applied;
+}
+
+PrecipitationAsyncCollision::PrecipitationAsyncCollision() {
+	thread = NULL;
+	start = Semaphore::create();
+	finished = Semaphore::create();
+	exit = false;
+	running = false;
+	snapshot_dirty = true;
+
+	batch_requests = NULL;
+	batch_size = 0;
+}
+
+PrecipitationAsyncCollision::~PrecipitationAsyncCollision() {
+	if (running)
+		finished->wait();
+
+	if (thread) {
+		exit = true;
+		start->post();
+		Thread::wait_to_finish(thread);
+		memdelete(thread);
+	}
+
+	memdelete(start);
+	memdelete(finished);
+}
@@ -0,0 +1,48 @@
+#ifndef PRECIPITATION_ASYNC_COLLISION_H
+#define PRECIPITATION_ASYNC_COLLISION_H
+
+#include "os/semaphore.h"
+#include "os/thread.h"
+#include "precipitation_collision_snapshot.h"
+#include "precipitation_occlusion_cache.h"
+
+// Resolves occlusion cache rays on a background thread against a snapshot of the static geometry, since the
+// physics space may only be queried from the thread that steps it. At most one batch is in flight; results
+// are applied by the first process() call after it finishes, so the main thread never waits on the worker.
+// The snapshot is only recaptured while no batch is in flight.
+
+class PrecipitationAsyncCollision {
+	Thread *thread;
+	Semaphore *start;
+	Semaphore *finished;
+	bool exit;
+	bool running;
+	bool snapshot_dirty;
+
+	PrecipitationCollisionSnapshot snapshot;
+	Vector<PrecipitationOcclusionCache::RayRequest> batch;
+	// The worker only sees the batch through this, so it never touches the Vector's reference count.
+	PrecipitationOcclusionCache::RayRequest *batch_requests;
+	int batch_size;
+
+	static void _thread_func(void *p_self);
+
+public:
+	// Applies a finished batch and submits the next one, returning the number of results applied.
+	// p_bounds is the area the queued rays can reach; the snapshot is recaptured around it when needed.
+	int process(PrecipitationOcclusionCache &p_cache, PhysicsDirectSpaceState *p_space, const AABB &p_bounds, uint32_t p_collision_mask, int p_batch_size);
+
+	// Recaptures static geometry before the next batch.
+	_FORCE_INLINE_ void invalidate() {
+		snapshot_dirty = true;
+	}
+
+	_FORCE_INLINE_ bool is_busy() const {
+		return running;
+	}
+
+	PrecipitationAsyncCollision();
+	~PrecipitationAsyncCollision();
+};
+
+#endif // PRECIPITATION_ASYNC_COLLISION_H
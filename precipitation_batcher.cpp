@@ -0,0 +1,233 @@
+#include "precipitation_batcher.h"
+
+PrecipitationBatcher *PrecipitationBatcher::singleton = NULL;
+
+PrecipitationBatcher *PrecipitationBatcher::get_singleton() {
+	return singleton;
+}
+
+PrecipitationBatcher::Batch *PrecipitationBatcher::_get_batch(RID p_scenario, const Ref<Material> &p_material, uint32_t p_layer_mask) {
+	for (int i = 0; i < batches.size(); i++) {
+		Batch *batch = batches[i];
+		if (batch->scenario == p_scenario && batch->material == p_material && batch->layer_mask == p_layer_mask)
+			return batch;
+	}
+
+	VisualServer *vs = VisualServer::get_singleton();
+
+	Batch *batch = memnew(Batch);
+	batch->scenario = p_scenario;
+	batch->material = p_material;
+	batch->layer_mask = p_layer_mask;
+	batch->idle_flushes = 0;
+	batch->mesh = vs->mesh_create();
+	batch->instance = vs->instance_create2(batch->mesh, p_scenario);
+	vs->instance_set_layer_mask(batch->instance, p_layer_mask);
+	if (p_material.is_valid())
+		vs->instance_geometry_set_material_override(batch->instance, p_material->get_rid());
+
+	batches.push_back(batch);
+	return batch;
+}
+
+void PrecipitationBatcher::_free_batch(Batch *p_batch) {
+	VisualServer *vs = VisualServer::get_singleton();
+	vs->free(p_batch->instance);
+	vs->free(p_batch->mesh);
+	memdelete(p_batch);
+}
+
+void PrecipitationBatcher::_build_batch(Batch *p_batch) {
+	int quad_count = 0;
+	bool using_colors = false;
+	for (int i = 0; i < p_batch->submissions.size(); i++) {
+		quad_count += p_batch->submissions[i].quad_count;
+		using_colors = using_colors || p_batch->submissions[i].colors.size() > 0;
+	}
+
+	// Same pattern as the emitters' own meshes; only the quads added since the last build need writing.
+	int old_index_count = p_batch->indices.size();
+	int index_count = quad_count * 6;
+	p_batch->indices.resize(index_count);
+	if (index_count > old_index_count) {
+		DVector<int>::Write w = p_batch->indices.write();
+		for (int i = old_index_count; i < index_count; i += 6) {
+			int base = (i / 6) * 4;
+			w[i + 0] = base;
+			w[i + 1] = base + 1;
+			w[i + 2] = base + 3;
+			w[i + 3] = base + 3;
+			w[i + 4] = base + 2;
+			w[i + 5] = base;
+		}
+	}
+
+	p_batch->vertices.resize(quad_count * 4);
+	p_batch->uvs.resize(quad_count * 4);
+	p_batch->colors.resize(using_colors ? quad_count * 4 : 0);
+
+	{
+		DVector<Vector3>::Write vertex_write = p_batch->vertices.write();
+		DVector<Vector2>::Write uv_write = p_batch->uvs.write();
+		DVector<Color>::Write color_write = p_batch->colors.write();
+		Vector3 *vertex = vertex_write.ptr();
+		Vector2 *uv = uv_write.ptr();
+		Color *color = color_write.ptr();
+
+		for (int i = 0; i < p_batch->submissions.size(); i++) {
+			const Submission &submission = p_batch->submissions[i];
+			int vertex_count = submission.quad_count * 4;
+
+			DVector<Vector3>::Read vertices = submission.vertices.read();
+			if (submission.transform == Transform()) {
+				copymem(vertex, vertices.ptr(), vertex_count * sizeof(Vector3));
+			}
+			else {
+				for (int j = 0; j < vertex_count; j++) {
+					vertex[j] = submission.transform.xform(vertices[j]);
+				}
+			}
+
+			DVector<Vector2>::Read uvs = submission.uvs.read();
+			copymem(uv, uvs.ptr(), vertex_count * sizeof(Vector2));
+
+			if (using_colors) {
+				if (submission.colors.size() > 0) {
+					DVector<Color>::Read colors = submission.colors.read();
+					copymem(color, colors.ptr(), vertex_count * sizeof(Color));
+				}
+				else {
+					for (int j = 0; j < vertex_count; j++) {
+						color[j] = Color(1, 1, 1, 1);
+					}
+				}
+				color += vertex_count;
+			}
+
+			vertex += vertex_count;
+			uv += vertex_count;
+		}
+	}
+
+	Array arrays;
+	arrays.resize(VS::ARRAY_MAX);
+	arrays[VS::ARRAY_VERTEX] = p_batch->vertices;
+	arrays[VS::ARRAY_TEX_UV] = p_batch->uvs;
+	if (using_colors)
+		arrays[VS::ARRAY_COLOR] = p_batch->colors;
+	arrays[VS::ARRAY_INDEX] = p_batch->indices;
+	VisualServer::get_singleton()->mesh_add_surface(p_batch->mesh, VS::PRIMITIVE_TRIANGLES, arrays);
+}
+
+void PrecipitationBatcher::_flush() {
+	flush_queued = false;
+
+	VisualServer *vs = VisualServer::get_singleton();
+
+	for (int i = 0; i < batches.size(); i++) {
+		Batch *batch = batches[i];
+
+		while (vs->mesh_get_surface_count(batch->mesh))
+			vs->mesh_remove_surface(batch->mesh, 0);
+
+		// Nothing drew with this world, material and layers this frame. The cleared mesh draws nothing, and
+		// the batch is only let go once it has stayed empty for a while.
+		if (batch->submissions.empty()) {
+			if (++batch->idle_flushes > BATCH_IDLE_FLUSHES) {
+				_free_batch(batch);
+				batches.remove(i);
+				i--;
+			}
+			continue;
+		}
+
+		batch->idle_flushes = 0;
+		_build_batch(batch);
+		batch->submissions.clear();
+	}
+}
+
+void PrecipitationBatcher::register_emitter(Precipitation *p_emitter) {
+	emitters.insert(p_emitter);
+}
+
+void PrecipitationBatcher::unregister_emitter(Precipitation *p_emitter) {
+	emitters.erase(p_emitter);
+
+	for (int i = 0; i < batches.size(); i++) {
+		Vector<Submission> &submissions = batches[i]->submissions;
+		for (int j = 0; j < submissions.size(); j++) {
+			if (submissions[j].emitter == p_emitter) {
+				submissions.remove(j);
+				j--;
+			}
+		}
+	}
+
+	// The last emitter to go takes the batches with it, so nothing is drawn for an empty level.
+	if (emitters.empty()) {
+		for (int i = 0; i < batches.size(); i++) {
+			_free_batch(batches[i]);
+		}
+		batches.clear();
+	}
+}
+
+void PrecipitationBatcher::queue_flush() {
+	if (flush_queued)
+		return;
+
+	flush_queued = true;
+	call_deferred("_flush");
+}
+
+void PrecipitationBatcher::submit(Precipitation *p_emitter, RID p_scenario, const Ref<Material> &p_material, uint32_t p_layer_mask, const Transform &p_transform, const DVector<Vector3> &p_vertices, const DVector<Vector2> &p_uvs, const DVector<Color> &p_colors, int p_quad_count) {
+	ERR_FAIL_COND(!emitters.has(p_emitter));
+	ERR_FAIL_COND(p_vertices.size() < p_quad_count * 4 || p_uvs.size() < p_quad_count * 4);
+	ERR_FAIL_COND(p_colors.size() > 0 && p_colors.size() < p_quad_count * 4);
+
+	if (p_quad_count <= 0)
+		return;
+
+	// The arrays are shared, not copied; the emitter's next write copies them only if this frame's flush
+	// has not released them yet.
+	Submission submission;
+	submission.emitter = p_emitter;
+	submission.transform = p_transform;
+	submission.vertices = p_vertices;
+	submission.uvs = p_uvs;
+	submission.colors = p_colors;
+	submission.quad_count = p_quad_count;
+
+	_get_batch(p_scenario, p_material, p_layer_mask)->submissions.push_back(submission);
+	queue_flush();
+}
+
+int PrecipitationBatcher::get_emitter_count() const {
+	return emitters.size();
+}
+
+int PrecipitationBatcher::get_batch_count() const {
+	return batches.size();
+}
+
+void PrecipitationBatcher::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("_flush"), &PrecipitationBatcher::_flush);
+
+	ObjectTypeDB::bind_method(_MD("get_emitter_count"), &PrecipitationBatcher::get_emitter_count);
+	ObjectTypeDB::bind_method(_MD("get_batch_count"), &PrecipitationBatcher::get_batch_count);
+}
+
+PrecipitationBatcher::PrecipitationBatcher() {
+	singleton = this;
+	flush_queued = false;
+}
+
+PrecipitationBatcher::~PrecipitationBatcher() {
+	for (int i = 0; i < batches.size(); i++) {
+		_free_batch(batches[i]);
+	}
+	batches.clear();
+
+	singleton = NULL;
+}
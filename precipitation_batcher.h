@@ -0,0 +1,83 @@
+#ifndef PRECIPITATION_BATCHER_H
+#define PRECIPITATION_BATCHER_H
+
+#include "object.h"
+#include "scene/resources/material.h"
+#include "servers/visual_server.h"
+
+class Precipitation;
+
+// Merges the quads of every Precipitation node with using_batching on into one mesh per world, material and
+// layer mask, so a level with several emitters draws each material once. Emitters register while they are
+// in the tree and submit their arrays as they draw; the merged meshes are rebuilt once per frame in a
+// deferred flush, after every emitter has drawn, and drawn through the visual server directly.
+class PrecipitationBatcher : public Object {
+
+	OBJ_TYPE(PrecipitationBatcher, Object);
+
+	static PrecipitationBatcher *singleton;
+
+	enum {
+		// How many flushes a batch nothing was submitted to keeps its visual server resources, so an emitter
+		// that is briefly hidden or culled does not recreate them when it comes back.
+		BATCH_IDLE_FLUSHES = 120
+	};
+
+	struct Submission {
+		Precipitation *emitter;
+		Transform transform;
+		DVector<Vector3> vertices;
+		DVector<Vector2> uvs;
+		DVector<Color> colors;
+		int quad_count;
+	};
+
+	struct Batch {
+		RID scenario;
+		Ref<Material> material;
+		uint32_t layer_mask;
+
+		RID mesh;
+		RID instance;
+		Vector<Submission> submissions;
+		int idle_flushes;
+
+		DVector<Vector3> vertices;
+		DVector<Vector2> uvs;
+		DVector<Color> colors;
+		DVector<int> indices;
+	};
+
+	Set<Precipitation *> emitters;
+	Vector<Batch *> batches;
+	bool flush_queued;
+
+	Batch *_get_batch(RID p_scenario, const Ref<Material> &p_material, uint32_t p_layer_mask);
+	void _free_batch(Batch *p_batch);
+	void _build_batch(Batch *p_batch);
+	void _flush();
+
+protected:
+	static void _bind_methods();
+
+public:
+	static PrecipitationBatcher *get_singleton();
+
+	void register_emitter(Precipitation *p_emitter);
+	void unregister_emitter(Precipitation *p_emitter);
+
+	// Called by every registered emitter each frame, drawing or not, so the batches are rebuilt even on
+	// frames nothing is submitted and last frame's quads do not linger.
+	void queue_flush();
+	// Adds p_quad_count quads, four vertices each, to this frame's batch for the given world, material and
+	// layers. Vertices are in the emitter's space and moved into the world by p_transform.
+	void submit(Precipitation *p_emitter, RID p_scenario, const Ref<Material> &p_material, uint32_t p_layer_mask, const Transform &p_transform, const DVector<Vector3> &p_vertices, const DVector<Vector2> &p_uvs, const DVector<Color> &p_colors, int p_quad_count);
+
+	int get_emitter_count() const;
+	int get_batch_count() const;
+
+	PrecipitationBatcher();
+	~PrecipitationBatcher();
+};
+
+#endif // PRECIPITATION_BATCHER_H
@@ -0,0 +1,452 @@
+#include "precipitation_benchmark.h"
+#include "os/os.h"
+#include "scene/3d/physics_body.h"
+#include "scene/resources/box_shape.h"
+
+namespace {
+
+struct PhaseSample {
+	uint64_t usec;
+	int64_t bytes;
+	uint64_t start_usec;
+	uint64_t start_bytes;
+
+	void begin() {
+		start_bytes = Memory::get_static_mem_usage();
+		start_usec = OS::get_singleton()->get_ticks_usec();
+	}
+
+	void end() {
+		usec += OS::get_singleton()->get_ticks_usec() - start_usec;
+		bytes += (int64_t)Memory::get_static_mem_usage() - (int64_t)start_bytes;
+	}
+
+	Dictionary report(int p_frames, int p_particles) const {
+		Dictionary d;
+		d["ns_per_particle"] = (double)usec * 1000.0 / ((double)MAX(p_frames, 1) * MAX(p_particles, 1));
+		d["bytes_per_frame"] = (double)bytes / MAX(p_frames, 1);
+		d["peak_bytes"] = Memory::get_static_mem_max_usage();
+		return d;
+	}
+
+	PhaseSample() {
+		usec = 0;
+		bytes = 0;
+		start_usec = 0;
+		start_bytes = 0;
+	}
+};
+
+Array _config_array(const Dictionary &p_config, const String &p_key, const Array &p_default) {
+	if (!p_config.has(p_key))
+		return p_default;
+
+	Array a = p_config[p_key];
+	return a.size() ? a : p_default;
+}
+
+// The vector kernels do the same operations as the scalar one, so anything past rounding noise is a bug.
+const float KERNEL_CHECK_TOLERANCE = 1e-4;
+// Position levels of compact storage a drop may drift from float storage per square root of the steps taken,
+// plus one; see PrecipitationCompactPool.
+const float COMPACT_CHECK_LEVELS_PER_ROOT_STEP = 3.0;
+// Not a multiple of any vector width, so the scalar tail is checked as well.
+const int CHECK_PARTICLES = 4099;
+const int CHECK_STEPS = 64;
+
+void _fill_check_pool(PrecipitationParticlePool &r_pool, uint32_t p_count, uint32_t p_seed, const Vector3 &p_min, const Vector3 &p_size) {
+	PrecipitationRandom random;
+	random.set_seed(p_seed);
+
+	r_pool.resize(p_count);
+	random.fill(r_pool.position_x, p_count, p_min.x, p_min.x + p_size.x);
+	random.fill(r_pool.position_y, p_count, p_min.y, p_min.y + p_size.y);
+	random.fill(r_pool.position_z, p_count, p_min.z, p_min.z + p_size.z);
+	random.fill(r_pool.velocity, p_count, 0.05, 0.5);
+	random.fill_reciprocal(r_pool.inv_mass, p_count, 0.5, 2.0);
+	// Half the cutoffs are inside the box, so drops cross them during the run.
+	random.fill(r_pool.hit_height, p_count, p_min.y - p_size.y, p_min.y + p_size.y);
+
+	for (uint32_t i = 0; i < p_count; i++) {
+		r_pool.tex_coord_index[i] = 0;
+		r_pool.flags[i] = PrecipitationParticlePool::FLAG_VALID;
+		r_pool.lod_band[i] = 0;
+	}
+}
+
+// The box drifts like the benchmark camera, so drops wrap out of every side.
+PrecipitationStepParams _check_step_params(int p_step, const Vector3 &p_size) {
+	PrecipitationStepParams params;
+	params.wind_x = 0.3;
+	params.wind_y = 0.0;
+	params.wind_z = -0.2;
+	params.fall_scale = 1.0;
+	params.box_min_x = p_step * 0.37 - p_size.x * 0.5;
+	params.box_min_y = p_step * 0.05 - p_size.y * 0.5;
+	params.box_min_z = p_step * 0.21 - p_size.z * 0.5;
+	params.box_size_x = p_size.x;
+	params.box_size_y = p_size.y;
+	params.box_size_z = p_size.z;
+	return params;
+}
+
+} // namespace
+
+void PrecipitationBenchmark::_build_scene(uint32_t p_seed) {
+	_clear_scene();
+
+	scene = memnew(Spatial);
+	add_child(scene);
+
+	// A ground slab under a grid of boxes of random height, covering more than the default box so the
+	// occlusion cache keeps casting as the camera moves.
+	PrecipitationRandom random;
+	random.set_seed(p_seed);
+
+	Ref<BoxShape> ground_shape = memnew(BoxShape);
+	ground_shape->set_extents(Vector3(64, 0.5, 64));
+	StaticBody *ground = memnew(StaticBody);
+	ground->add_shape(ground_shape);
+	ground->set_translation(Vector3(0, -5.5, 0));
+	scene->add_child(ground);
+
+	const int grid = 16;
+	const float spacing = 4.0;
+	for (int z = 0; z < grid; z++) {
+		for (int x = 0; x < grid; x++) {
+			float height = random.randf() * 6.0;
+
+			Ref<BoxShape> shape = memnew(BoxShape);
+			shape->set_extents(Vector3(1.0, height * 0.5 + 0.05, 1.0));
+
+			StaticBody *body = memnew(StaticBody);
+			body->add_shape(shape);
+			body->set_translation(Vector3((x - grid / 2) * spacing, -5.0 + height * 0.5, (z - grid / 2) * spacing));
+			scene->add_child(body);
+		}
+	}
+}
+
+void PrecipitationBenchmark::_clear_scene() {
+	if (scene == NULL)
+		return;
+
+	remove_child(scene);
+	memdelete(scene);
+	scene = NULL;
+}
+
+Dictionary PrecipitationBenchmark::_run_case(int p_particles, int p_drops_per_texture, bool p_billboards, bool p_collision, bool p_specialized, int p_frames, uint32_t p_seed, int p_render_mode) {
+	camera->set_translation(Vector3());
+
+	Precipitation *precipitation = memnew(Precipitation);
+	precipitation->set_max_particles(p_particles);
+	precipitation->set_drops_per_texture(p_drops_per_texture);
+	precipitation->set_using_billboards(p_billboards);
+	precipitation->set_using_collision(p_collision);
+	precipitation->set_render_mode((Precipitation::RenderMode)p_render_mode);
+	precipitation->set_using_specialized_kernels(p_specialized);
+	add_child(precipitation);
+
+	// The benchmark ticks the node itself.
+	precipitation->set_fixed_process(false);
+	precipitation->set_process(false);
+	precipitation->set_camera(precipitation->get_path_to(camera));
+	precipitation->_update_visibility_box();
+
+	const float delta = 1.0 / 60.0;
+	PhaseSample populate;
+	PhaseSample process;
+	PhaseSample cutoff;
+	PhaseSample draw;
+
+	precipitation->set_seed(p_seed);
+
+	populate.begin();
+	precipitation->populate_particles(delta);
+	precipitation->update_render_cache();
+	precipitation->pending_update = false;
+	populate.end();
+
+	// The cutoff phase recomputes every drop through the same dispatch the simulation uses for wrapped ones.
+	Vector<uint32_t> all_indices;
+	all_indices.resize(p_particles);
+	for (int i = 0; i < p_particles; i++) {
+		all_indices[i] = i;
+	}
+
+	for (int i = 0; i < p_frames; i++) {
+		// Keep the camera moving so wrapping, respawns and cache misses happen every frame.
+		camera->set_translation(Vector3(i * 0.37, 0, i * 0.21));
+		precipitation->_update_visibility_box();
+
+		process.begin();
+		precipitation->_precipitation_process(delta);
+		process.end();
+
+		uint32_t count = precipitation->_get_particle_count();
+		cutoff.begin();
+		precipitation->_dispatch_cutoff_points(all_indices.ptr(), MIN(count, (uint32_t)all_indices.size()));
+		cutoff.end();
+
+		draw.begin();
+		precipitation->draw_particles();
+		draw.end();
+	}
+
+	Dictionary phases;
+	phases["populate"] = populate.report(1, p_particles);
+	phases["process"] = process.report(p_frames, p_particles);
+	phases["cutoff"] = cutoff.report(p_frames, p_particles);
+	phases["draw"] = draw.report(p_frames, p_particles);
+
+	Dictionary result;
+	result["particles"] = p_particles;
+	result["drops_per_texture"] = p_drops_per_texture;
+	result["billboards"] = p_billboards;
+	result["collision"] = p_collision;
+	result["specialized"] = p_specialized;
+	result["phases"] = phases;
+
+	remove_child(precipitation);
+	memdelete(precipitation);
+
+	return result;
+}
+
+Dictionary PrecipitationBenchmark::check_kernels(int p_particles, int p_steps, uint32_t p_seed) {
+	Dictionary result;
+	ERR_FAIL_COND_V(p_particles <= 0 || p_steps <= 0, result);
+
+	const Vector3 box_size = Vector3(20, 20, 20);
+	PrecipitationParticlePool reference;
+	PrecipitationParticlePool vector;
+	_fill_check_pool(reference, p_particles, p_seed, -box_size * 0.5, box_size);
+	_fill_check_pool(vector, p_particles, p_seed, -box_size * 0.5, box_size);
+
+	Vector<uint32_t> reference_wrapped;
+	Vector<uint32_t> vector_wrapped;
+	Vector<uint32_t> reference_impacts;
+	Vector<uint32_t> vector_impacts;
+	reference_wrapped.resize(p_particles);
+	vector_wrapped.resize(p_particles);
+	reference_impacts.resize(p_particles);
+	vector_impacts.resize(p_particles);
+
+	float max_error = 0;
+	int mismatches = 0;
+
+	for (int step = 0; step < p_steps; step++) {
+		PrecipitationStepParams params = _check_step_params(step, box_size);
+
+		uint32_t reference_impact_count = 0;
+		uint32_t vector_impact_count = 0;
+		uint32_t reference_wrapped_count = precipitation_integrate_and_wrap_scalar(reference, 0, p_particles, params, reference_wrapped.ptr(), reference_impacts.ptr(), &reference_impact_count);
+		uint32_t vector_wrapped_count = precipitation_integrate_and_wrap(vector, 0, p_particles, params, vector_wrapped.ptr(), vector_impacts.ptr(), &vector_impact_count);
+
+		if (reference_wrapped_count != vector_wrapped_count || reference_impact_count != vector_impact_count) {
+			mismatches++;
+		}
+		else {
+			for (uint32_t i = 0; i < reference_wrapped_count; i++) {
+				mismatches += reference_wrapped[i] != vector_wrapped[i];
+			}
+			for (uint32_t i = 0; i < reference_impact_count; i++) {
+				mismatches += reference_impacts[i] != vector_impacts[i];
+			}
+		}
+
+		for (int i = 0; i < p_particles; i++) {
+			max_error = MAX(max_error, ABS(reference.position_x[i] - vector.position_x[i]));
+			max_error = MAX(max_error, ABS(reference.position_y[i] - vector.position_y[i]));
+			max_error = MAX(max_error, ABS(reference.position_z[i] - vector.position_z[i]));
+			mismatches += reference.flags[i] != vector.flags[i];
+		}
+	}
+
+	result["width"] = precipitation_get_integrate_width();
+	result["max_error"] = max_error;
+	result["tolerance"] = KERNEL_CHECK_TOLERANCE;
+	result["mismatches"] = mismatches;
+	result["passed"] = max_error <= KERNEL_CHECK_TOLERANCE && mismatches == 0;
+	return result;
+}
+
+Dictionary PrecipitationBenchmark::check_compact_storage(int p_particles, int p_steps, uint32_t p_seed) {
+	Dictionary result;
+	ERR_FAIL_COND_V(p_particles <= 0 || p_steps <= 0, result);
+
+	const Vector3 box_size = Vector3(20, 20, 20);
+	PrecipitationParticlePool reference;
+	_fill_check_pool(reference, p_particles, p_seed, -box_size * 0.5, box_size);
+
+	PrecipitationCompactPool compact;
+	compact.set_ranges(0.05, 0.5, 0.5, 2.0);
+	compact.resize(p_particles);
+	PrecipitationCompactPool::Frame frame;
+	frame.set_box(-box_size * 0.5, box_size);
+	compact.encode(reference, 0, p_particles, frame);
+
+	// Both start from what compact storage holds, so they share the speed and mass levels and only the
+	// rounding of positions and cutoffs tells them apart.
+	compact.decode(0, p_particles, frame, reference);
+
+	PrecipitationParticlePool scratch;
+	scratch.resize(p_particles);
+	Vector<uint32_t> wrapped;
+	Vector<uint32_t> impacts;
+	wrapped.resize(p_particles);
+	impacts.resize(p_particles);
+
+	float levels = 1.0 + COMPACT_CHECK_LEVELS_PER_ROOT_STEP * Math::sqrt((float)p_steps);
+	float position_bound = levels * MAX(box_size.x, MAX(box_size.y, box_size.z)) / 65536.0;
+	// Cutoffs are rounded once, to half a level; the other half allows for float error in the world heights.
+	float height_bound = box_size.y * 3.0 / 65534.0;
+
+	float max_position_error = 0;
+	float max_height_error = 0;
+
+	for (int step = 1; step <= p_steps; step++) {
+		PrecipitationStepParams params = _check_step_params(step, box_size);
+		uint32_t impact_count = 0;
+		precipitation_integrate_and_wrap(reference, 0, p_particles, params, wrapped.ptr(), impacts.ptr(), &impact_count);
+
+		// The same round trip the emitter makes: decode in the last step's box, step, encode in the new one.
+		PrecipitationCompactPool::Frame next = frame;
+		next.set_box(Vector3(params.box_min_x, params.box_min_y, params.box_min_z), box_size);
+		next.dither = frame.dither + 2654435769u;
+
+		compact.decode(0, p_particles, frame, scratch);
+		impact_count = 0;
+		precipitation_integrate_and_wrap(scratch, 0, p_particles, params, wrapped.ptr(), impacts.ptr(), &impact_count);
+		compact.encode(scratch, 0, p_particles, next);
+		frame = next;
+		compact.decode(0, p_particles, frame, scratch);
+
+		// Cutoffs below the range compact storage covers are stored as no cutoff, as intended, and those within
+		// rounding of its bottom may have been.
+		float lowest_height = frame.height_origin + height_bound;
+
+		for (int i = 0; i < p_particles; i++) {
+			// A drop on the edge of the box may have wrapped in one storage and not yet in the other.
+			float dx = Math::fmod(ABS(reference.position_x[i] - scratch.position_x[i]), box_size.x);
+			float dy = Math::fmod(ABS(reference.position_y[i] - scratch.position_y[i]), box_size.y);
+			float dz = Math::fmod(ABS(reference.position_z[i] - scratch.position_z[i]), box_size.z);
+			max_position_error = MAX(max_position_error, MIN(dx, box_size.x - dx));
+			max_position_error = MAX(max_position_error, MIN(dy, box_size.y - dy));
+			max_position_error = MAX(max_position_error, MIN(dz, box_size.z - dz));
+
+			if (reference.hit_height[i] >= lowest_height)
+				max_height_error = MAX(max_height_error, ABS(reference.hit_height[i] - scratch.hit_height[i]));
+		}
+	}
+
+	result["max_position_error"] = max_position_error;
+	result["position_bound"] = position_bound;
+	result["max_height_error"] = max_height_error;
+	result["height_bound"] = height_bound;
+	result["passed"] = max_position_error <= position_bound && max_height_error <= height_bound;
+	return result;
+}
+
+Dictionary PrecipitationBenchmark::run(const Dictionary &p_config) {
+	Dictionary output;
+	ERR_FAIL_COND_V(!is_inside_tree(), output);
+
+	Array default_counts;
+	default_counts.push_back(1000);
+	default_counts.push_back(10000);
+	default_counts.push_back(100000);
+	default_counts.push_back(1000000);
+
+	Array default_dpt;
+	default_dpt.push_back(1);
+	default_dpt.push_back(4);
+
+	Array default_switch;
+	default_switch.push_back(false);
+	default_switch.push_back(true);
+
+	Array counts = _config_array(p_config, "particle_counts", default_counts);
+	Array drops_per_texture = _config_array(p_config, "drops_per_texture", default_dpt);
+	Array billboards = _config_array(p_config, "billboards", default_switch);
+	Array collision = _config_array(p_config, "collision", default_switch);
+	Array specialized = _config_array(p_config, "specialized", default_switch);
+	int frames = p_config.has("frames") ? MAX((int)p_config["frames"], 1) : 60;
+	uint32_t seed = p_config.has("seed") ? (int)p_config["seed"] : 0;
+	int render_mode = p_config.has("render_mode") ? (int)p_config["render_mode"] : (int)Precipitation::RENDER_MODE_MESH;
+
+	// Timings of a kernel that computes the wrong thing are meaningless.
+	Dictionary kernel_check = check_kernels(CHECK_PARTICLES, CHECK_STEPS, seed);
+	output["kernel_check"] = kernel_check;
+	if (!(bool)kernel_check["passed"]) {
+		ERR_EXPLAIN("The vector integrate kernel does not match the scalar one: " + kernel_check.to_json());
+		ERR_FAIL_V(output);
+	}
+
+	Dictionary compact_check = check_compact_storage(CHECK_PARTICLES, CHECK_STEPS, seed);
+	output["compact_check"] = compact_check;
+	if (!(bool)compact_check["passed"]) {
+		ERR_EXPLAIN("Compact storage drifts further from float storage than its quantisation allows: " + compact_check.to_json());
+		ERR_FAIL_V(output);
+	}
+
+	_build_scene(seed);
+
+	Array results;
+	for (int c = 0; c < counts.size(); c++) {
+		for (int d = 0; d < drops_per_texture.size(); d++) {
+			for (int b = 0; b < billboards.size(); b++) {
+				for (int k = 0; k < collision.size(); k++) {
+					Dictionary generic_phases;
+					for (int v = 0; v < specialized.size(); v++) {
+						Dictionary result = _run_case(counts[c], drops_per_texture[d], billboards[b], collision[k], specialized[v], frames, seed, render_mode);
+						Dictionary phases = result["phases"];
+
+						if (!(bool)specialized[v]) {
+							generic_phases = phases;
+						}
+						else if (generic_phases.size()) {
+							Dictionary speedup;
+							const String phase_names[] = { "process", "cutoff", "draw" };
+							for (int p = 0; p < 3; p++) {
+								double generic_ns = ((Dictionary)generic_phases[phase_names[p]])["ns_per_particle"];
+								double specialized_ns = ((Dictionary)phases[phase_names[p]])["ns_per_particle"];
+								speedup[phase_names[p]] = specialized_ns > 0 ? generic_ns / specialized_ns : 1.0;
+							}
+							result["speedup"] = speedup;
+						}
+
+						results.push_back(result);
+					}
+				}
+			}
+		}
+	}
+
+	_clear_scene();
+
+	output["seed"] = seed;
+	output["frames"] = frames;
+	output["render_mode"] = render_mode;
+	output["results"] = results;
+	return output;
+}
+
+String PrecipitationBenchmark::run_json(const Dictionary &p_config) {
+	return run(p_config).to_json();
+}
+
+void PrecipitationBenchmark::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("run", "config"), &PrecipitationBenchmark::run, DEFVAL(Dictionary()));
+	ObjectTypeDB::bind_method(_MD("run_json", "config"), &PrecipitationBenchmark::run_json, DEFVAL(Dictionary()));
+	ObjectTypeDB::bind_method(_MD("check_kernels", "particles", "steps", "seed"), &PrecipitationBenchmark::check_kernels);
+	ObjectTypeDB::bind_method(_MD("check_compact_storage", "particles", "steps", "seed"), &PrecipitationBenchmark::check_compact_storage);
+}
+
+PrecipitationBenchmark::PrecipitationBenchmark() {
+	camera = memnew(Camera);
+	add_child(camera);
+
+	scene = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef PRECIPITATION_BENCHMARK_H
+#define PRECIPITATION_BENCHMARK_H
+
+#include "scene/3d/spatial.h"
+#include "scene/3d/camera.h"
+#include "precipitation.h"
+
+// Drives the phases of a Precipitation node directly and times them, so the module can be measured without
+// a running game. Add it to a scene tree (a headless server build running a script with -s is enough) and
+// call run(), or run_json() for output that can be stored and compared between builds.
+//
+// Every combination of the configured particle counts, drops_per_texture values, billboard, collision and
+// specialized kernel settings is run from the same seed against a synthetic field of static boxes. Each
+// phase reports:
+//   ns_per_particle    wall time divided by frames and particles
+//   bytes_per_frame    net growth of the engine's static memory usage per frame
+//   peak_bytes         the engine's static memory high-water mark after the phase
+// Before any case, run() checks that the vector integrate kernel of this build matches the scalar one and
+// that compact storage stays within its quantisation bound of float storage, and fails if either does not;
+// the checks are also available on their own as check_kernels() and check_compact_storage().
+//
+// A specialized case run right after the same case with the generic kernels also reports, under speedup,
+// the generic ns_per_particle of its process, cutoff and draw phases divided by its own.
+class PrecipitationBenchmark : public Spatial {
+
+	OBJ_TYPE(PrecipitationBenchmark, Spatial);
+
+	Camera *camera;
+	Spatial *scene;
+
+	void _build_scene(uint32_t p_seed);
+	void _clear_scene();
+
+	Dictionary _run_case(int p_particles, int p_drops_per_texture, bool p_billboards, bool p_collision, bool p_specialized, int p_frames, uint32_t p_seed, int p_render_mode);
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Recognised keys, all optional: particle_counts (IntArray), drops_per_texture (IntArray), billboards,
+	// collision and specialized (Array of bools), frames, seed and render_mode.
+	Dictionary run(const Dictionary &p_config);
+	// Steps one seeded pool with the scalar integrate kernel and an identical one with the vector kernel
+	// compiled into this build, and reports the vector width, the largest position difference, how many
+	// flags, wrapped or impact lists disagreed, and whether that is within tolerance.
+	Dictionary check_kernels(int p_particles, int p_steps, uint32_t p_seed);
+	// Steps one seeded set of drops in float storage and in compact storage, from the same speed and mass
+	// levels, and reports the largest position and cutoff height differences in world units, the bounds the
+	// compact pool documents for that many steps, and whether both are within them.
+	Dictionary check_compact_storage(int p_particles, int p_steps, uint32_t p_seed);
+	String run_json(const Dictionary &p_config);
+
+	PrecipitationBenchmark();
+};
+
+#endif // PRECIPITATION_BENCHMARK_H
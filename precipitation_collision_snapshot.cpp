@@ -0,0 +1,248 @@
+#include "precipitation_collision_snapshot.h"
+#include "geometry.h"
+#include "quick_hull.h"
+
+void PrecipitationCollisionSnapshot::_add_convex(const DVector<Plane> &p_planes, const Transform &p_xform, const AABB &p_aabb) {
+	Convex convex;
+	convex.aabb = p_xform.xform(p_aabb);
+	convex.plane_offset = convex_planes.size();
+	convex.plane_count = p_planes.size();
+
+	if (!convex.aabb.intersects(bounds) || convex.plane_count == 0)
+		return;
+
+	DVector<Plane>::Read r = p_planes.read();
+	for (int i = 0; i < convex.plane_count; i++) {
+		convex_planes.push_back(p_xform.xform(r[i]));
+	}
+	convexes.push_back(convex);
+}
+
+void PrecipitationCollisionSnapshot::_add_shape(PhysicsServer *p_server, RID p_shape, const Transform &p_xform) {
+	Variant data = p_server->shape_get_data(p_shape);
+
+	switch (p_server->shape_get_type(p_shape)) {
+		case PhysicsServer::SHAPE_PLANE: {
+			planes.push_back(p_xform.xform((Plane)data));
+		} break;
+		case PhysicsServer::SHAPE_SPHERE: {
+			float radius = data;
+			_add_convex(Geometry::build_sphere_planes(radius, 8, 8), p_xform, AABB(Vector3(-radius, -radius, -radius), Vector3(radius, radius, radius) * 2));
+		} break;
+		case PhysicsServer::SHAPE_BOX: {
+			Vector3 extents = data;
+			_add_convex(Geometry::build_box_planes(extents), p_xform, AABB(-extents, extents * 2));
+		} break;
+		case PhysicsServer::SHAPE_CAPSULE: {
+			Dictionary d = data;
+			float radius = d["radius"];
+			float height = d["height"];
+			Vector3 extents = Vector3(radius, radius, height * 0.5 + radius);
+			_add_convex(Geometry::build_capsule_planes(radius, height, 8, 4), p_xform, AABB(-extents, extents * 2));
+		} break;
+		case PhysicsServer::SHAPE_CONVEX_POLYGON: {
+			DVector<Vector3> points = data;
+			if (points.size() < 4)
+				break;
+
+			Vector<Vector3> hull_points;
+			AABB aabb;
+			DVector<Vector3>::Read r = points.read();
+			for (int i = 0; i < points.size(); i++) {
+				hull_points.push_back(r[i]);
+				if (i == 0)
+					aabb.pos = r[i];
+				else
+					aabb.expand_to(r[i]);
+			}
+
+			Geometry::MeshData md;
+			if (QuickHull::build(hull_points, md) != OK)
+				break;
+
+			DVector<Plane> hull_planes;
+			for (int i = 0; i < md.faces.size(); i++) {
+				hull_planes.push_back(md.faces[i].plane);
+			}
+			_add_convex(hull_planes, p_xform, aabb);
+		} break;
+		case PhysicsServer::SHAPE_CONCAVE_POLYGON: {
+			DVector<Vector3> faces = data;
+			DVector<Vector3>::Read r = faces.read();
+			int face_count = faces.size() / 3;
+
+			for (int i = 0; i < face_count; i++) {
+				Triangle triangle;
+				for (int j = 0; j < 3; j++) {
+					triangle.vertex[j] = p_xform.xform(r[i * 3 + j]);
+				}
+				triangle.aabb = AABB(triangle.vertex[0], Vector3());
+				triangle.aabb.expand_to(triangle.vertex[1]);
+				triangle.aabb.expand_to(triangle.vertex[2]);
+
+				if (triangle.aabb.intersects(bounds))
+					triangles.push_back(triangle);
+			}
+		} break;
+		default: {
+			// Rays, heightmaps and custom shapes do not stop precipitation.
+		} break;
+	}
+}
+
+void PrecipitationCollisionSnapshot::_get_cell_range(const AABB &p_aabb, int &r_min_x, int &r_min_z, int &r_max_x, int &r_max_z) const {
+	float scale_x = GRID_RESOLUTION / MAX(bounds.size.x, CMP_EPSILON);
+	float scale_z = GRID_RESOLUTION / MAX(bounds.size.z, CMP_EPSILON);
+
+	r_min_x = CLAMP((int)Math::floor((p_aabb.pos.x - bounds.pos.x) * scale_x), 0, GRID_RESOLUTION - 1);
+	r_min_z = CLAMP((int)Math::floor((p_aabb.pos.z - bounds.pos.z) * scale_z), 0, GRID_RESOLUTION - 1);
+	r_max_x = CLAMP((int)Math::floor((p_aabb.pos.x + p_aabb.size.x - bounds.pos.x) * scale_x), 0, GRID_RESOLUTION - 1);
+	r_max_z = CLAMP((int)Math::floor((p_aabb.pos.z + p_aabb.size.z - bounds.pos.z) * scale_z), 0, GRID_RESOLUTION - 1);
+}
+
+template <class T>
+void PrecipitationCollisionSnapshot::_bucket(const Vector<T> &p_items, Vector<int> &r_start, Vector<int> &r_cell_items) const {
+	const int cell_count = GRID_RESOLUTION * GRID_RESOLUTION;
+	r_start.resize(cell_count + 1);
+	for (int i = 0; i <= cell_count; i++) {
+		r_start[i] = 0;
+	}
+
+	// Count per cell, turn the counts into run starts, then fill each run from its start.
+	int min_x, min_z, max_x, max_z;
+	for (int i = 0; i < p_items.size(); i++) {
+		_get_cell_range(p_items[i].aabb, min_x, min_z, max_x, max_z);
+		for (int z = min_z; z <= max_z; z++) {
+			for (int x = min_x; x <= max_x; x++) {
+				r_start[z * GRID_RESOLUTION + x + 1]++;
+			}
+		}
+	}
+
+	for (int i = 0; i < cell_count; i++) {
+		r_start[i + 1] += r_start[i];
+	}
+
+	Vector<int> fill;
+	fill.resize(cell_count);
+	for (int i = 0; i < cell_count; i++) {
+		fill[i] = r_start[i];
+	}
+
+	r_cell_items.resize(r_start[cell_count]);
+	for (int i = 0; i < p_items.size(); i++) {
+		_get_cell_range(p_items[i].aabb, min_x, min_z, max_x, max_z);
+		for (int z = min_z; z <= max_z; z++) {
+			for (int x = min_x; x <= max_x; x++) {
+				r_cell_items[fill[z * GRID_RESOLUTION + x]++] = i;
+			}
+		}
+	}
+}
+
+void PrecipitationCollisionSnapshot::_build_grid() {
+	_bucket(convexes, cell_convex_start, cell_convex_items);
+	_bucket(triangles, cell_triangle_start, cell_triangle_items);
+}
+
+void PrecipitationCollisionSnapshot::capture(PhysicsDirectSpaceState *p_space, const AABB &p_bounds, uint32_t p_collision_mask, const Set<RID> &p_exclude) {
+	clear();
+
+	bounds = p_bounds;
+	collision_mask = p_collision_mask;
+	captured = true;
+
+	if (p_space) {
+		PhysicsServer *server = PhysicsServer::get_singleton();
+
+		RID query = server->shape_create(PhysicsServer::SHAPE_BOX);
+		server->shape_set_data(query, p_bounds.size * 0.5);
+		Transform xform;
+		xform.origin = p_bounds.pos + p_bounds.size * 0.5;
+
+		Vector<PhysicsDirectSpaceState::ShapeResult> results;
+		results.resize(MAX_SHAPES);
+		int count = p_space->intersect_shape(query, xform, 0, results.ptr(), MAX_SHAPES, p_exclude, p_collision_mask, PhysicsDirectSpaceState::TYPE_MASK_STATIC_BODY);
+		server->free(query);
+
+		for (int i = 0; i < count; i++) {
+			RID body = results[i].rid;
+			int shape = results[i].shape;
+
+			Transform body_xform = server->body_get_state(body, PhysicsServer::BODY_STATE_TRANSFORM);
+			_add_shape(server, server->body_get_shape(body, shape), body_xform * server->body_get_shape_transform(body, shape));
+		}
+	}
+
+	_build_grid();
+}
+
+void PrecipitationCollisionSnapshot::clear() {
+	captured = false;
+	planes.clear();
+	convex_planes.clear();
+	convexes.clear();
+	triangles.clear();
+	cell_convex_start.clear();
+	cell_convex_items.clear();
+	cell_triangle_start.clear();
+	cell_triangle_items.clear();
+}
+
+bool PrecipitationCollisionSnapshot::intersect_segment(const Vector3 &p_from, const Vector3 &p_to, Vector3 &r_position) const {
+	float closest = 1e20;
+	Vector3 hit;
+	Vector3 normal;
+
+	for (int i = 0; i < planes.size(); i++) {
+		if (planes[i].intersects_segment(p_from, p_to, &hit) && p_from.distance_squared_to(hit) < closest) {
+			closest = p_from.distance_squared_to(hit);
+			r_position = hit;
+		}
+	}
+
+	if (!captured || cell_convex_start.empty())
+		return closest < 1e20;
+
+	AABB segment = AABB(p_from, Vector3());
+	segment.expand_to(p_to);
+	int min_x, min_z, max_x, max_z;
+	_get_cell_range(segment, min_x, min_z, max_x, max_z);
+
+	const Plane *plane_data = convex_planes.ptr();
+
+	for (int z = min_z; z <= max_z; z++) {
+		for (int x = min_x; x <= max_x; x++) {
+			int cell = z * GRID_RESOLUTION + x;
+
+			for (int i = cell_convex_start[cell]; i < cell_convex_start[cell + 1]; i++) {
+				const Convex &convex = convexes[cell_convex_items[i]];
+				if (!convex.aabb.intersects_segment(p_from, p_to))
+					continue;
+
+				if (Geometry::segment_intersects_convex(p_from, p_to, plane_data + convex.plane_offset, convex.plane_count, &hit, &normal) && p_from.distance_squared_to(hit) < closest) {
+					closest = p_from.distance_squared_to(hit);
+					r_position = hit;
+				}
+			}
+
+			for (int i = cell_triangle_start[cell]; i < cell_triangle_start[cell + 1]; i++) {
+				const Triangle &triangle = triangles[cell_triangle_items[i]];
+				if (!triangle.aabb.intersects_segment(p_from, p_to))
+					continue;
+
+				if (Geometry::segment_intersects_triangle(p_from, p_to, triangle.vertex[0], triangle.vertex[1], triangle.vertex[2], &hit) && p_from.distance_squared_to(hit) < closest) {
+					closest = p_from.distance_squared_to(hit);
+					r_position = hit;
+				}
+			}
+		}
+	}
+
+	return closest < 1e20;
+}
+
+PrecipitationCollisionSnapshot::PrecipitationCollisionSnapshot() {
+	collision_mask = 0;
+	captured = false;
+}
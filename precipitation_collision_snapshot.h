@@ -0,0 +1,65 @@
+#ifndef PRECIPITATION_COLLISION_SNAPSHOT_H
+#define PRECIPITATION_COLLISION_SNAPSHOT_H
+
+#include "servers/physics_server.h"
+
+// World-space copy of the static collision shapes inside an area, so rays can be cast against it from a
+// thread other than the one stepping physics. Convex shapes are kept as plane sets and concave ones as
+// triangles, both bucketed in a horizontal grid since the occlusion rays are close to vertical. Planes are
+// unbounded and tested by every ray. Static bodies that move or appear after capture are not seen until the
+// next capture.
+
+class PrecipitationCollisionSnapshot {
+	enum {
+		GRID_RESOLUTION = 32,
+		MAX_SHAPES = 4096,
+	};
+
+	struct Convex {
+		AABB aabb;
+		int plane_offset;
+		int plane_count;
+	};
+
+	struct Triangle {
+		Vector3 vertex[3];
+		AABB aabb;
+	};
+
+	AABB bounds;
+	uint32_t collision_mask;
+	bool captured;
+
+	Vector<Plane> planes;
+	Vector<Plane> convex_planes;
+	Vector<Convex> convexes;
+	Vector<Triangle> triangles;
+
+	// Per grid cell, the run [start[cell], start[cell + 1]) of items overlapping it.
+	Vector<int> cell_convex_start;
+	Vector<int> cell_convex_items;
+	Vector<int> cell_triangle_start;
+	Vector<int> cell_triangle_items;
+
+	void _add_shape(PhysicsServer *p_server, RID p_shape, const Transform &p_xform);
+	void _add_convex(const DVector<Plane> &p_planes, const Transform &p_xform, const AABB &p_aabb);
+	void _build_grid();
+	template <class T>
+	void _bucket(const Vector<T> &p_items, Vector<int> &r_start, Vector<int> &r_cell_items) const;
+	void _get_cell_range(const AABB &p_aabb, int &r_min_x, int &r_min_z, int &r_max_x, int &r_max_z) const;
+
+public:
+	void capture(PhysicsDirectSpaceState *p_space, const AABB &p_bounds, uint32_t p_collision_mask, const Set<RID> &p_exclude);
+	void clear();
+
+	_FORCE_INLINE_ bool covers(const AABB &p_bounds, uint32_t p_collision_mask) const {
+		return captured && collision_mask == p_collision_mask && bounds.encloses(p_bounds);
+	}
+
+	// Closest hit along the segment, if any. Safe to call from any thread while nothing captures.
+	bool intersect_segment(const Vector3 &p_from, const Vector3 &p_to, Vector3 &r_position) const;
+
+	PrecipitationCollisionSnapshot();
+};
+
+#endif // PRECIPITATION_COLLISION_SNAPSHOT_H
@@ -0,0 +1,270 @@
+#include "precipitation_compact_pool.h"
+#include "precipitation_occlusion_cache.h"
+#include "os/memory.h"
+
+#define COMPACT_ARRAY_SIZE(m_type, m_capacity) ((sizeof(m_type) * (m_capacity) + PrecipitationParticlePool::ALIGNMENT - 1) & ~(size_t)(PrecipitationParticlePool::ALIGNMENT - 1))
+
+static const float COMPACT_POSITION_STEPS = 65536.0f;
+// Added before truncating so anything down to a box below the origin still rounds down; further out a drop
+// can be a level off, which the toroidal coordinates absorb. Kept small so, near the box, the float sum
+// resolves the dither offset to 1/64 of a level. Encoding is quantized either way: a position lands within
+// one level, 1/65536 of the box, and a cutoff height within one height level, three box heights / 65534.
+static const float COMPACT_POSITION_BIAS = 65536.0f;
+// Golden ratio in 32-bit fixed point; stepping by it spreads the rounding offsets evenly over [0, 1).
+static const uint32_t COMPACT_DITHER_STEP = 2654435769u;
+static const float COMPACT_HEIGHT_STEPS = 65534.0f;
+
+static size_t _compact_block_size(uint32_t p_capacity) {
+	return COMPACT_ARRAY_SIZE(uint16_t, p_capacity) * 5 +
+		   COMPACT_ARRAY_SIZE(uint8_t, p_capacity) * 4 +
+		   PrecipitationParticlePool::ALIGNMENT;
+}
+
+PrecipitationCompactPool::Frame::Frame() {
+	dither = 0;
+	set_box(Vector3(), Vector3(1, 1, 1));
+}
+
+void PrecipitationCompactPool::Frame::set_box(const Vector3 &p_min, const Vector3 &p_size) {
+	origin_x = p_min.x;
+	origin_y = p_min.y;
+	origin_z = p_min.z;
+	size_x = MAX(p_size.x, CMP_EPSILON);
+	size_y = MAX(p_size.y, CMP_EPSILON);
+	size_z = MAX(p_size.z, CMP_EPSILON);
+
+	// In double, since the origin can be many boxes away from zero.
+	double x = (double)origin_x / size_x;
+	double y = (double)origin_y / size_y;
+	double z = (double)origin_z / size_z;
+	anchor_x = (int32_t)((x - Math::floor(x)) * COMPACT_POSITION_STEPS + 0.5) & 0xFFFF;
+	anchor_y = (int32_t)((y - Math::floor(y)) * COMPACT_POSITION_STEPS + 0.5) & 0xFFFF;
+	anchor_z = (int32_t)((z - Math::floor(z)) * COMPACT_POSITION_STEPS + 0.5) & 0xFFFF;
+
+	double height_step = (double)size_y * 3.0 / COMPACT_HEIGHT_STEPS;
+	height_origin = Math::floor(((double)origin_y - size_y) / height_step) * height_step;
+}
+
+void PrecipitationCompactPool::_assign_arrays(uint8_t *p_block, uint32_t p_capacity) {
+	uint8_t *ptr = (uint8_t *)(((size_t)p_block + PrecipitationParticlePool::ALIGNMENT - 1) & ~(size_t)(PrecipitationParticlePool::ALIGNMENT - 1));
+
+	position_x = (uint16_t *)ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint16_t, p_capacity);
+	position_y = (uint16_t *)ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint16_t, p_capacity);
+	position_z = (uint16_t *)ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint16_t, p_capacity);
+	hit_height = (uint16_t *)ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint16_t, p_capacity);
+	tex_coord_index = (uint16_t *)ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint16_t, p_capacity);
+	speed = ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint8_t, p_capacity);
+	inv_mass = ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint8_t, p_capacity);
+	flags = ptr;
+	ptr += COMPACT_ARRAY_SIZE(uint8_t, p_capacity);
+	lod_band = ptr;
+}
+
+void PrecipitationCompactPool::reserve(uint32_t p_capacity) {
+	p_capacity = (p_capacity + PrecipitationParticlePool::CAPACITY_GRANULARITY - 1) & ~(uint32_t)(PrecipitationParticlePool::CAPACITY_GRANULARITY - 1);
+	if (p_capacity <= capacity)
+		return;
+
+	uint8_t *new_block = (uint8_t *)memalloc(_compact_block_size(p_capacity));
+	ERR_FAIL_COND(!new_block);
+
+	uint16_t *old_position_x = position_x;
+	uint16_t *old_position_y = position_y;
+	uint16_t *old_position_z = position_z;
+	uint16_t *old_hit_height = hit_height;
+	uint16_t *old_tex_coord_index = tex_coord_index;
+	uint8_t *old_speed = speed;
+	uint8_t *old_inv_mass = inv_mass;
+	uint8_t *old_flags = flags;
+	uint8_t *old_lod_band = lod_band;
+
+	_assign_arrays(new_block, p_capacity);
+
+	if (block) {
+		copymem(position_x, old_position_x, sizeof(uint16_t) * count);
+		copymem(position_y, old_position_y, sizeof(uint16_t) * count);
+		copymem(position_z, old_position_z, sizeof(uint16_t) * count);
+		copymem(hit_height, old_hit_height, sizeof(uint16_t) * count);
+		copymem(tex_coord_index, old_tex_coord_index, sizeof(uint16_t) * count);
+		copymem(speed, old_speed, sizeof(uint8_t) * count);
+		copymem(inv_mass, old_inv_mass, sizeof(uint8_t) * count);
+		copymem(flags, old_flags, sizeof(uint8_t) * count);
+		copymem(lod_band, old_lod_band, sizeof(uint8_t) * count);
+		memfree(block);
+	}
+
+	block = new_block;
+	capacity = p_capacity;
+}
+
+uint32_t PrecipitationCompactPool::spawn(uint32_t p_count) {
+	uint32_t first = count;
+	if (count + p_count > capacity)
+		reserve(MAX(count + p_count, capacity * 2));
+	count += p_count;
+	return first;
+}
+
+void PrecipitationCompactPool::resize(uint32_t p_count) {
+	if (p_count > capacity)
+		reserve(p_count);
+	count = p_count;
+}
+
+void PrecipitationCompactPool::clear() {
+	if (block)
+		memfree(block);
+
+	block = NULL;
+	count = 0;
+	capacity = 0;
+
+	position_x = NULL;
+	position_y = NULL;
+	position_z = NULL;
+	hit_height = NULL;
+	tex_coord_index = NULL;
+	speed = NULL;
+	inv_mass = NULL;
+	flags = NULL;
+	lod_band = NULL;
+}
+
+void PrecipitationCompactPool::set_ranges(float p_min_speed, float p_max_speed, float p_min_inv_mass, float p_max_inv_mass) {
+	speed_min = p_min_speed;
+	speed_step = (p_max_speed - p_min_speed) / 255.0f;
+	inv_mass_min = p_min_inv_mass;
+	inv_mass_step = (p_max_inv_mass - p_min_inv_mass) / 255.0f;
+}
+
+void PrecipitationCompactPool::decode(uint32_t p_from, uint32_t p_to, const Frame &p_frame, PrecipitationParticlePool &r_pool) const {
+	const uint32_t n = p_to - p_from;
+	const float scale_x = p_frame.size_x / COMPACT_POSITION_STEPS;
+	const float scale_y = p_frame.size_y / COMPACT_POSITION_STEPS;
+	const float scale_z = p_frame.size_z / COMPACT_POSITION_STEPS;
+	const float height_min = p_frame.height_origin;
+	const float height_step = p_frame.size_y * 3.0f / COMPACT_HEIGHT_STEPS;
+
+	const uint16_t *px = position_x + p_from;
+	const uint16_t *py = position_y + p_from;
+	const uint16_t *pz = position_z + p_from;
+	const uint16_t *ph = hit_height + p_from;
+	const uint16_t *pt = tex_coord_index + p_from;
+	const uint8_t *ps = speed + p_from;
+	const uint8_t *pm = inv_mass + p_from;
+
+	for (uint32_t i = 0; i < n; i++) {
+		r_pool.position_x[i] = p_frame.origin_x + (float)(((int32_t)px[i] - p_frame.anchor_x) & 0xFFFF) * scale_x;
+		r_pool.position_y[i] = p_frame.origin_y + (float)(((int32_t)py[i] - p_frame.anchor_y) & 0xFFFF) * scale_y;
+		r_pool.position_z[i] = p_frame.origin_z + (float)(((int32_t)pz[i] - p_frame.anchor_z) & 0xFFFF) * scale_z;
+
+		int32_t h = ph[i];
+		float height = height_min + (h - 1) * height_step;
+		r_pool.hit_height[i] = h ? height : PrecipitationOcclusionCache::EMPTY_HEIGHT;
+
+		r_pool.velocity[i] = speed_min + ps[i] * speed_step;
+		r_pool.inv_mass[i] = inv_mass_min + pm[i] * inv_mass_step;
+		r_pool.tex_coord_index[i] = pt[i];
+	}
+
+	copymem(r_pool.flags, flags + p_from, n);
+	copymem(r_pool.lod_band, lod_band + p_from, n);
+}
+
+void PrecipitationCompactPool::encode(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const Frame &p_frame) {
+	const uint32_t n = p_to - p_from;
+	const float inv_scale_x = COMPACT_POSITION_STEPS / p_frame.size_x;
+	const float inv_scale_y = COMPACT_POSITION_STEPS / p_frame.size_y;
+	const float inv_scale_z = COMPACT_POSITION_STEPS / p_frame.size_z;
+	const float height_min = p_frame.height_origin;
+	const float inv_height_step = COMPACT_HEIGHT_STEPS / (p_frame.size_y * 3.0f);
+	const float inv_speed_step = speed_step > 0 ? 1.0f / speed_step : 0.0f;
+	const float inv_inv_mass_step = inv_mass_step > 0 ? 1.0f / inv_mass_step : 0.0f;
+
+	uint16_t *px = position_x + p_from;
+	uint16_t *py = position_y + p_from;
+	uint16_t *pz = position_z + p_from;
+	uint16_t *ph = hit_height + p_from;
+	uint16_t *pt = tex_coord_index + p_from;
+	uint8_t *ps = speed + p_from;
+	uint8_t *pm = inv_mass + p_from;
+
+	// A drop that moves the same distance every step would otherwise round the same way every step and drift
+	// by up to half a level per step. Offsets from the golden ratio sequence differ between neighbouring drops
+	// and, with the dither, between steps, so along a drop's path they average out.
+	const uint32_t dither = p_frame.dither + p_from * COMPACT_DITHER_STEP;
+
+	for (uint32_t i = 0; i < n; i++) {
+		float offset = (int)((dither + i * COMPACT_DITHER_STEP) >> 8) * (1.0f / 16777216.0f) + COMPACT_POSITION_BIAS;
+		px[i] = (((int32_t)((p_pool.position_x[i] - p_frame.origin_x) * inv_scale_x + offset)) + p_frame.anchor_x) & 0xFFFF;
+		py[i] = (((int32_t)((p_pool.position_y[i] - p_frame.origin_y) * inv_scale_y + offset)) + p_frame.anchor_y) & 0xFFFF;
+		pz[i] = (((int32_t)((p_pool.position_z[i] - p_frame.origin_z) * inv_scale_z + offset)) + p_frame.anchor_z) & 0xFFFF;
+
+		// Anything at or below the bottom of the range, including no cutoff at all, becomes zero.
+		ph[i] = (int32_t)CLAMP((p_pool.hit_height[i] - height_min) * inv_height_step + 1.5f, 0.0f, 65535.0f);
+
+		ps[i] = (int32_t)CLAMP((p_pool.velocity[i] - speed_min) * inv_speed_step + 0.5f, 0.0f, 255.0f);
+		pm[i] = (int32_t)CLAMP((p_pool.inv_mass[i] - inv_mass_min) * inv_inv_mass_step + 0.5f, 0.0f, 255.0f);
+		pt[i] = MIN(p_pool.tex_coord_index[i], 65535u);
+	}
+
+	copymem(flags + p_from, p_pool.flags, n);
+	copymem(lod_band + p_from, p_pool.lod_band, n);
+}
+
+void PrecipitationCompactPool::encode_flags(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to) {
+	copymem(flags + p_from, p_pool.flags, p_to - p_from);
+	copymem(lod_band + p_from, p_pool.lod_band, p_to - p_from);
+}
+
+Vector3 PrecipitationCompactPool::get_position(uint32_t p_index, const Frame &p_frame) const {
+	return Vector3(
+			p_frame.origin_x + (float)(((int32_t)position_x[p_index] - p_frame.anchor_x) & 0xFFFF) * (p_frame.size_x / COMPACT_POSITION_STEPS),
+			p_frame.origin_y + (float)(((int32_t)position_y[p_index] - p_frame.anchor_y) & 0xFFFF) * (p_frame.size_y / COMPACT_POSITION_STEPS),
+			p_frame.origin_z + (float)(((int32_t)position_z[p_index] - p_frame.anchor_z) & 0xFFFF) * (p_frame.size_z / COMPACT_POSITION_STEPS));
+}
+
+void PrecipitationCompactPool::set_position(uint32_t p_index, const Vector3 &p_position, const Frame &p_frame) {
+	position_x[p_index] = (((int32_t)((p_position.x - p_frame.origin_x) * (COMPACT_POSITION_STEPS / p_frame.size_x) + COMPACT_POSITION_BIAS + 0.5f)) + p_frame.anchor_x) & 0xFFFF;
+	position_y[p_index] = (((int32_t)((p_position.y - p_frame.origin_y) * (COMPACT_POSITION_STEPS / p_frame.size_y) + COMPACT_POSITION_BIAS + 0.5f)) + p_frame.anchor_y) & 0xFFFF;
+	position_z[p_index] = (((int32_t)((p_position.z - p_frame.origin_z) * (COMPACT_POSITION_STEPS / p_frame.size_z) + COMPACT_POSITION_BIAS + 0.5f)) + p_frame.anchor_z) & 0xFFFF;
+}
+
+float PrecipitationCompactPool::get_hit_height(uint32_t p_index, const Frame &p_frame) const {
+	int32_t h = hit_height[p_index];
+	if (h == 0)
+		return PrecipitationOcclusionCache::EMPTY_HEIGHT;
+	return p_frame.height_origin + (h - 1) * (p_frame.size_y * 3.0f / COMPACT_HEIGHT_STEPS);
+}
+
+void PrecipitationCompactPool::set_hit_height(uint32_t p_index, float p_height, const Frame &p_frame) {
+	float height_min = p_frame.height_origin;
+	hit_height[p_index] = (int32_t)CLAMP((p_height - height_min) * (COMPACT_HEIGHT_STEPS / (p_frame.size_y * 3.0f)) + 1.5f, 0.0f, 65535.0f);
+}
+
+void PrecipitationCompactPool::set_speed(uint32_t p_index, float p_speed) {
+	float level = speed_step > 0 ? (p_speed - speed_min) / speed_step : 0.0f;
+	speed[p_index] = (int32_t)CLAMP(level + 0.5f, 0.0f, 255.0f);
+}
+
+void PrecipitationCompactPool::set_inv_mass(uint32_t p_index, float p_inv_mass) {
+	float level = inv_mass_step > 0 ? (p_inv_mass - inv_mass_min) / inv_mass_step : 0.0f;
+	inv_mass[p_index] = (int32_t)CLAMP(level + 0.5f, 0.0f, 255.0f);
+}
+
+PrecipitationCompactPool::PrecipitationCompactPool() {
+	block = NULL;
+	clear();
+	set_ranges(0, 0, 0, 0);
+}
+
+PrecipitationCompactPool::~PrecipitationCompactPool() {
+	clear();
+}
@@ -0,0 +1,119 @@
+#ifndef PRECIPITATION_COMPACT_POOL_H
+#define PRECIPITATION_COMPACT_POOL_H
+
+#include "precipitation_particle_pool.h"
+
+// Quantized particle storage, 14 bytes per drop against the float pool's 30, so large emitters stay in
+// cache. Nothing simulates in this format: ranges are decoded into a float pool, processed by the usual
+// kernels and encoded back.
+//
+// Positions are toroidal 16-bit coordinates, the position modulo the box size in 1/65536ths of it. They do
+// not depend on where the box is; decoding places each drop at its image inside a given box, which is also
+// how a drop wraps. Cutoff heights are 16-bit offsets over three box heights, from one box below the box to
+// one above it, with zero for no cutoff. Speed and inverse mass are indices into 256 evenly spaced levels of
+// their ranges.
+//
+// Each encode puts a position within one level of the float value. The dither keeps the position errors of
+// successive steps from lining up, so after n steps a drop is within about 1 + 3 * sqrt(n) levels of where
+// the float pool would have it. Height levels, three box heights / 65534 apart, are fixed in the world, so a
+// cutoff is rounded once, to within half a level, and encoding it again in a moved box does not round it
+// further.
+// PrecipitationBenchmark::check_compact_storage() measures both.
+
+class PrecipitationCompactPool {
+public:
+	// The box positions are decoded into and cutoff heights are relative to.
+	struct Frame {
+		float origin_x;
+		float origin_y;
+		float origin_z;
+		float size_x;
+		float size_y;
+		float size_z;
+
+		// Toroidal coordinate of the origin.
+		int32_t anchor_x;
+		int32_t anchor_y;
+		int32_t anchor_z;
+
+		// Bottom of the cutoff height range, a box below the box, snapped to a whole number of height levels so
+		// the levels stay where they are in the world while the box moves.
+		float height_origin;
+
+		// Shifts the rounding offsets encode() uses; should change every step.
+		uint32_t dither;
+
+		// Leaves the dither as it is.
+		void set_box(const Vector3 &p_min, const Vector3 &p_size);
+
+		Frame();
+	};
+
+	uint16_t *position_x;
+	uint16_t *position_y;
+	uint16_t *position_z;
+	uint16_t *hit_height;
+	uint16_t *tex_coord_index;
+	uint8_t *speed;
+	uint8_t *inv_mass;
+	uint8_t *flags;
+	uint8_t *lod_band;
+
+private:
+	uint8_t *block;
+	uint32_t count;
+	uint32_t capacity;
+
+	float speed_min;
+	float speed_step;
+	float inv_mass_min;
+	float inv_mass_step;
+
+	void _assign_arrays(uint8_t *p_block, uint32_t p_capacity);
+
+public:
+	void reserve(uint32_t p_capacity);
+	uint32_t spawn(uint32_t p_count);
+	void resize(uint32_t p_count);
+	void clear();
+
+	_FORCE_INLINE_ uint32_t size() const {
+		return count;
+	}
+
+	_FORCE_INLINE_ uint32_t get_capacity() const {
+		return capacity;
+	}
+
+	// Stored levels keep their index, so changing a range moves every drop to the matching level of the new one.
+	void set_ranges(float p_min_speed, float p_max_speed, float p_min_inv_mass, float p_max_inv_mass);
+
+	// Decodes [p_from, p_to) into r_pool at [0, p_to - p_from); r_pool must already have that many drops.
+	void decode(uint32_t p_from, uint32_t p_to, const Frame &p_frame, PrecipitationParticlePool &r_pool) const;
+	// Encodes p_pool[0, p_to - p_from) into [p_from, p_to). Positions are rounded with an offset per drop that
+	// moves on with the frame's dither, so the rounding errors along a drop's path average out instead of adding up.
+	void encode(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const Frame &p_frame);
+	// Encodes only the flags and level of detail bands, which is all culling changes.
+	void encode_flags(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to);
+
+	Vector3 get_position(uint32_t p_index, const Frame &p_frame) const;
+	void set_position(uint32_t p_index, const Vector3 &p_position, const Frame &p_frame);
+	float get_hit_height(uint32_t p_index, const Frame &p_frame) const;
+	void set_hit_height(uint32_t p_index, float p_height, const Frame &p_frame);
+
+	_FORCE_INLINE_ float get_speed(uint32_t p_index) const {
+		return speed_min + speed[p_index] * speed_step;
+	}
+
+	_FORCE_INLINE_ float get_inv_mass(uint32_t p_index) const {
+		return inv_mass_min + inv_mass[p_index] * inv_mass_step;
+	}
+
+	void set_speed(uint32_t p_index, float p_speed);
+	void set_inv_mass(uint32_t p_index, float p_inv_mass);
+
+	PrecipitationCompactPool();
+	~PrecipitationCompactPool();
+};
+
+#endif // PRECIPITATION_COMPACT_POOL_H
@@ -0,0 +1,317 @@
+#include "precipitation_kernels.h"
+#include "math_funcs.h"
+
+#if defined(__AVX__)
+#define PRECIPITATION_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PRECIPITATION_SSE2
+#include <emmintrin.h>
+#endif
+
+static _FORCE_INLINE_ uint32_t _flag_lanes(uint32_t p_base, int p_lanes, int p_wrapped, int p_respawn, int p_below, uint8_t *p_flags, uint32_t *r_wrapped, uint32_t *r_impacts, uint32_t *r_impact_count) {
+	uint32_t appended = 0;
+
+	for (int lane = 0; lane < p_lanes; lane++) {
+		int bit = 1 << lane;
+		uint32_t index = p_base + lane;
+
+		if (p_below & bit) {
+			// Only the step that takes a drop past its cutoff is an impact.
+			if (p_flags[index] & PrecipitationParticlePool::FLAG_VALID)
+				r_impacts[(*r_impact_count)++] = index;
+			p_flags[index] &= ~PrecipitationParticlePool::FLAG_VALID;
+		}
+
+		if (p_wrapped & bit) {
+			if (p_respawn & bit)
+				p_flags[index] |= PrecipitationParticlePool::FLAG_RESPAWN;
+			r_wrapped[appended++] = index;
+		}
+	}
+
+	return appended;
+}
+
+uint32_t precipitation_integrate_and_wrap_scalar(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const PrecipitationStepParams &p_params, uint32_t *r_wrapped, uint32_t *r_impacts, uint32_t *r_impact_count) {
+	float *position_x = p_pool.position_x;
+	float *position_y = p_pool.position_y;
+	float *position_z = p_pool.position_z;
+	const float *velocity = p_pool.velocity;
+	const float *inv_mass = p_pool.inv_mass;
+	const float *hit_height = p_pool.hit_height;
+	uint8_t *flags = p_pool.flags;
+
+	float inv_size_x = 1.0 / p_params.box_size_x;
+	float inv_size_y = 1.0 / p_params.box_size_y;
+	float inv_size_z = 1.0 / p_params.box_size_z;
+
+	uint32_t wrapped_count = 0;
+
+	for (uint32_t i = p_from; i < p_to; i++) {
+		float x = position_x[i] + p_params.wind_x * inv_mass[i];
+		float y = position_y[i] + p_params.wind_y * inv_mass[i] - velocity[i] * p_params.fall_scale;
+		float z = position_z[i] + p_params.wind_z * inv_mass[i];
+
+		float kx = Math::floor((x - p_params.box_min_x) * inv_size_x);
+		float ky = Math::floor((y - p_params.box_min_y) * inv_size_y);
+		float kz = Math::floor((z - p_params.box_min_z) * inv_size_z);
+
+		x -= kx * p_params.box_size_x;
+		y -= ky * p_params.box_size_y;
+		z -= kz * p_params.box_size_z;
+
+		position_x[i] = x;
+		position_y[i] = y;
+		position_z[i] = z;
+
+		int wrapped = (kx != 0.0 || ky != 0.0 || kz != 0.0);
+		int respawn = ky < 0.0;
+		int below = y < hit_height[i];
+
+		if (wrapped | below)
+			wrapped_count += _flag_lanes(i, 1, wrapped, respawn, below, flags, r_wrapped + wrapped_count, r_impacts, r_impact_count);
+	}
+
+	return wrapped_count;
+}
+
+#if defined(PRECIPITATION_SSE2)
+
+static _FORCE_INLINE_ __m128 _floor_ps(__m128 p_value) {
+	// SSE2 has no floor instruction: truncate, then step down wherever truncation rounded up.
+	__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(p_value));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, p_value), _mm_set1_ps(1.0f)));
+}
+
+#endif
+
+uint32_t precipitation_integrate_and_wrap(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const PrecipitationStepParams &p_params, uint32_t *r_wrapped, uint32_t *r_impacts, uint32_t *r_impact_count) {
+	uint32_t wrapped_count = 0;
+	uint32_t i = p_from;
+
+#if defined(PRECIPITATION_AVX)
+	float *position_x = p_pool.position_x;
+	float *position_y = p_pool.position_y;
+	float *position_z = p_pool.position_z;
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 wind_x = _mm256_set1_ps(p_params.wind_x);
+	const __m256 wind_y = _mm256_set1_ps(p_params.wind_y);
+	const __m256 wind_z = _mm256_set1_ps(p_params.wind_z);
+	const __m256 fall_scale = _mm256_set1_ps(p_params.fall_scale);
+	const __m256 min_x = _mm256_set1_ps(p_params.box_min_x);
+	const __m256 min_y = _mm256_set1_ps(p_params.box_min_y);
+	const __m256 min_z = _mm256_set1_ps(p_params.box_min_z);
+	const __m256 size_x = _mm256_set1_ps(p_params.box_size_x);
+	const __m256 size_y = _mm256_set1_ps(p_params.box_size_y);
+	const __m256 size_z = _mm256_set1_ps(p_params.box_size_z);
+	const __m256 inv_size_x = _mm256_set1_ps(1.0f / p_params.box_size_x);
+	const __m256 inv_size_y = _mm256_set1_ps(1.0f / p_params.box_size_y);
+	const __m256 inv_size_z = _mm256_set1_ps(1.0f / p_params.box_size_z);
+
+	for (; i + 8 <= p_to; i += 8) {
+		__m256 inv_mass = _mm256_loadu_ps(p_pool.inv_mass + i);
+
+		__m256 x = _mm256_add_ps(_mm256_loadu_ps(position_x + i), _mm256_mul_ps(wind_x, inv_mass));
+		__m256 y = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(position_y + i), _mm256_mul_ps(wind_y, inv_mass)), _mm256_mul_ps(_mm256_loadu_ps(p_pool.velocity + i), fall_scale));
+		__m256 z = _mm256_add_ps(_mm256_loadu_ps(position_z + i), _mm256_mul_ps(wind_z, inv_mass));
+
+		__m256 kx = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(x, min_x), inv_size_x));
+		__m256 ky = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(y, min_y), inv_size_y));
+		__m256 kz = _mm256_floor_ps(_mm256_mul_ps(_mm256_sub_ps(z, min_z), inv_size_z));
+
+		x = _mm256_sub_ps(x, _mm256_mul_ps(kx, size_x));
+		y = _mm256_sub_ps(y, _mm256_mul_ps(ky, size_y));
+		z = _mm256_sub_ps(z, _mm256_mul_ps(kz, size_z));
+
+		_mm256_storeu_ps(position_x + i, x);
+		_mm256_storeu_ps(position_y + i, y);
+		_mm256_storeu_ps(position_z + i, z);
+
+		__m256 moved = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(kx, zero, _CMP_NEQ_OQ), _mm256_cmp_ps(ky, zero, _CMP_NEQ_OQ)), _mm256_cmp_ps(kz, zero, _CMP_NEQ_OQ));
+		int wrapped = _mm256_movemask_ps(moved);
+		int below = _mm256_movemask_ps(_mm256_cmp_ps(y, _mm256_loadu_ps(p_pool.hit_height + i), _CMP_LT_OQ));
+
+		if (wrapped | below) {
+			int respawn = _mm256_movemask_ps(_mm256_cmp_ps(ky, zero, _CMP_LT_OQ));
+			wrapped_count += _flag_lanes(i, 8, wrapped, respawn, below, p_pool.flags, r_wrapped + wrapped_count, r_impacts, r_impact_count);
+		}
+	}
+#elif defined(PRECIPITATION_SSE2)
+	float *position_x = p_pool.position_x;
+	float *position_y = p_pool.position_y;
+	float *position_z = p_pool.position_z;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 wind_x = _mm_set1_ps(p_params.wind_x);
+	const __m128 wind_y = _mm_set1_ps(p_params.wind_y);
+	const __m128 wind_z = _mm_set1_ps(p_params.wind_z);
+	const __m128 fall_scale = _mm_set1_ps(p_params.fall_scale);
+	const __m128 min_x = _mm_set1_ps(p_params.box_min_x);
+	const __m128 min_y = _mm_set1_ps(p_params.box_min_y);
+	const __m128 min_z = _mm_set1_ps(p_params.box_min_z);
+	const __m128 size_x = _mm_set1_ps(p_params.box_size_x);
+	const __m128 size_y = _mm_set1_ps(p_params.box_size_y);
+	const __m128 size_z = _mm_set1_ps(p_params.box_size_z);
+	const __m128 inv_size_x = _mm_set1_ps(1.0f / p_params.box_size_x);
+	const __m128 inv_size_y = _mm_set1_ps(1.0f / p_params.box_size_y);
+	const __m128 inv_size_z = _mm_set1_ps(1.0f / p_params.box_size_z);
+
+	for (; i + 4 <= p_to; i += 4) {
+		__m128 inv_mass = _mm_loadu_ps(p_pool.inv_mass + i);
+
+		__m128 x = _mm_add_ps(_mm_loadu_ps(position_x + i), _mm_mul_ps(wind_x, inv_mass));
+		__m128 y = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(position_y + i), _mm_mul_ps(wind_y, inv_mass)), _mm_mul_ps(_mm_loadu_ps(p_pool.velocity + i), fall_scale));
+		__m128 z = _mm_add_ps(_mm_loadu_ps(position_z + i), _mm_mul_ps(wind_z, inv_mass));
+
+		__m128 kx = _floor_ps(_mm_mul_ps(_mm_sub_ps(x, min_x), inv_size_x));
+		__m128 ky = _floor_ps(_mm_mul_ps(_mm_sub_ps(y, min_y), inv_size_y));
+		__m128 kz = _floor_ps(_mm_mul_ps(_mm_sub_ps(z, min_z), inv_size_z));
+
+		x = _mm_sub_ps(x, _mm_mul_ps(kx, size_x));
+		y = _mm_sub_ps(y, _mm_mul_ps(ky, size_y));
+		z = _mm_sub_ps(z, _mm_mul_ps(kz, size_z));
+
+		_mm_storeu_ps(position_x + i, x);
+		_mm_storeu_ps(position_y + i, y);
+		_mm_storeu_ps(position_z + i, z);
+
+		__m128 moved = _mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(kx, zero), _mm_cmpneq_ps(ky, zero)), _mm_cmpneq_ps(kz, zero));
+		int wrapped = _mm_movemask_ps(moved);
+		int below = _mm_movemask_ps(_mm_cmplt_ps(y, _mm_loadu_ps(p_pool.hit_height + i)));
+
+		if (wrapped | below) {
+			int respawn = _mm_movemask_ps(_mm_cmplt_ps(ky, zero));
+			wrapped_count += _flag_lanes(i, 4, wrapped, respawn, below, p_pool.flags, r_wrapped + wrapped_count, r_impacts, r_impact_count);
+		}
+	}
+#endif
+
+	if (i < p_to)
+		wrapped_count += precipitation_integrate_and_wrap_scalar(p_pool, i, p_to, p_params, r_wrapped + wrapped_count, r_impacts, r_impact_count);
+
+	return wrapped_count;
+}
+
+int precipitation_get_integrate_width() {
+#if defined(PRECIPITATION_AVX)
+	return 8;
+#elif defined(PRECIPITATION_SSE2)
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+void precipitation_apply_wind(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const float *p_wind_x, const float *p_wind_y, const float *p_wind_z, float p_scale) {
+	float *position_x = p_pool.position_x;
+	float *position_y = p_pool.position_y;
+	float *position_z = p_pool.position_z;
+	const float *inv_mass = p_pool.inv_mass;
+
+	for (uint32_t i = p_from; i < p_to; i++) {
+		float scale = inv_mass[i] * p_scale;
+		position_x[i] += p_wind_x[i] * scale;
+		position_y[i] += p_wind_y[i] * scale;
+		position_z[i] += p_wind_z[i] * scale;
+	}
+}
+
+template <int DISTANCE, int LOD>
+static uint32_t _precipitation_cull(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, uint32_t p_index_offset, const PrecipitationCullParams &p_params, uint32_t *r_band_counts) {
+	const float *position_x = p_pool.position_x;
+	const float *position_y = p_pool.position_y;
+	const float *position_z = p_pool.position_z;
+	uint8_t *flags = p_pool.flags;
+	uint8_t *lod_band = p_pool.lod_band;
+
+	const float radius = p_params.radius;
+	// With no distance limit every particle passes the distance test.
+	const float max_distance_squared = p_params.max_distance_squared > 0.0 ? p_params.max_distance_squared : 1e30;
+
+	// Local copies let the compiler keep the parameters in registers; they could otherwise alias the pool.
+	float band_distance_squared[PrecipitationCullParams::MAX_LOD_BANDS - 1];
+	float band_density[PrecipitationCullParams::MAX_LOD_BANDS];
+	for (int j = 0; j < PrecipitationCullParams::MAX_LOD_BANDS; j++) {
+		if (j < PrecipitationCullParams::MAX_LOD_BANDS - 1)
+			band_distance_squared[j] = p_params.lod_band_distance_squared[j];
+		band_density[j] = p_params.lod_band_density[j];
+	}
+
+	uint32_t band_counts[PrecipitationCullParams::MAX_LOD_BANDS] = {};
+
+	for (uint32_t i = p_from; i < p_to; i++) {
+		float x = position_x[i];
+		float y = position_y[i];
+		float z = position_z[i];
+
+		// Compiled out with neither a distance limit nor bands, along with the loads of the camera position.
+		float distance_squared = 0;
+		if (DISTANCE != PRECIPITATION_FEATURE_OFF || LOD != PRECIPITATION_FEATURE_OFF) {
+			float dx = x - p_params.camera_x;
+			float dy = y - p_params.camera_y;
+			float dz = z - p_params.camera_z;
+			distance_squared = dx * dx + dy * dy + dz * dz;
+		}
+		int visible = DISTANCE != PRECIPITATION_FEATURE_OFF ? distance_squared <= max_distance_squared : 1;
+
+		for (int j = 0; j < PrecipitationCullParams::PLANE_COUNT; j++) {
+			float distance = p_params.plane_x[j] * x + p_params.plane_y[j] * y + p_params.plane_z[j] * z - p_params.plane_d[j];
+			visible &= distance <= radius;
+		}
+
+		// Without bands every drop is in the first one, which draws them all.
+		int band = 0;
+		if (LOD != PRECIPITATION_FEATURE_OFF) {
+			// Band limits ascend, so selecting instead of indexing the density table keeps this a plain vector select.
+			float density = band_density[0];
+			for (int j = 0; j < PrecipitationCullParams::MAX_LOD_BANDS - 1; j++) {
+				int beyond = distance_squared > band_distance_squared[j];
+				band += beyond;
+				density = beyond ? band_density[j + 1] : density;
+			}
+
+			// Multiplicative hashing by the golden ratio spreads consecutive indices evenly over [0, 1).
+			float rank = (int)(((i + p_index_offset) * 2654435761u) >> 8) * (1.0f / 16777216.0f);
+			visible &= rank < density;
+		}
+
+		uint8_t f = (flags[i] & ~PrecipitationParticlePool::FLAG_RENDER) | (visible * PrecipitationParticlePool::FLAG_RENDER);
+		flags[i] = f;
+		lod_band[i] = band;
+
+		// Counted per band with compares rather than an indexed increment, which would stop vectorisation.
+		uint32_t drawn = visible & (f & PrecipitationParticlePool::FLAG_VALID);
+		if (LOD != PRECIPITATION_FEATURE_OFF) {
+			for (int j = 0; j < PrecipitationCullParams::MAX_LOD_BANDS; j++) {
+				band_counts[j] += drawn & (band == j);
+			}
+		}
+		else {
+			band_counts[0] += drawn;
+		}
+	}
+
+	uint32_t visible_count = 0;
+	for (int j = 0; j < PrecipitationCullParams::MAX_LOD_BANDS; j++) {
+		r_band_counts[j] = band_counts[j];
+		visible_count += band_counts[j];
+	}
+	return visible_count;
+}
+
+uint32_t precipitation_cull(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, uint32_t p_index_offset, const PrecipitationCullParams &p_params, uint32_t *r_band_counts) {
+	return _precipitation_cull<PRECIPITATION_FEATURE_DYNAMIC, PRECIPITATION_FEATURE_DYNAMIC>(p_pool, p_from, p_to, p_index_offset, p_params, r_band_counts);
+}
+
+PrecipitationCullFunction precipitation_get_cull_function(const PrecipitationCullParams &p_params) {
+	bool using_distance = p_params.max_distance_squared > 0.0;
+	// Band limits ascend, so the first one tells whether there is more than one band.
+	bool using_lod = p_params.lod_band_distance_squared[0] < 1e30 || p_params.lod_band_density[0] < 1.0;
+
+	if (using_distance)
+		return using_lod ? _precipitation_cull<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_ON> : _precipitation_cull<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_OFF>;
+	else
+		return using_lod ? _precipitation_cull<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_ON> : _precipitation_cull<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_OFF>;
+}
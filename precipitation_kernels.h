@@ -0,0 +1,102 @@
+#ifndef PRECIPITATION_KERNELS_H
+#define PRECIPITATION_KERNELS_H
+
+#include "precipitation_particle_pool.h"
+
+// Per-step constants shared by every particle of an emitter. The box is given as its minimum corner and
+// size so wrapping is a single floor() per axis.
+struct PrecipitationStepParams {
+	// Displacement per unit of inverse mass over this step.
+	float wind_x;
+	float wind_y;
+	float wind_z;
+	// Converts a particle's fall speed, stored per reference step, to this step.
+	float fall_scale;
+
+	float box_min_x;
+	float box_min_y;
+	float box_min_z;
+
+	float box_size_x;
+	float box_size_y;
+	float box_size_z;
+};
+
+// Frustum planes (normals pointing out of the volume), an optional distance limit and distance-based
+// level of detail bands for culling. Counts are fixed so the tests unroll: unused planes should be
+// (0, 0, 0, 1e30), which pass everything, and unused band limits 1e30.
+struct PrecipitationCullParams {
+	enum {
+		PLANE_COUNT = 6,
+		MAX_LOD_BANDS = 4
+	};
+
+	float plane_x[PLANE_COUNT];
+	float plane_y[PLANE_COUNT];
+	float plane_z[PLANE_COUNT];
+	float plane_d[PLANE_COUNT];
+
+	float camera_x;
+	float camera_y;
+	float camera_z;
+
+	// Zero disables the distance test.
+	float max_distance_squared;
+	// Bounding radius of the largest drop quad.
+	float radius;
+
+	// Squared outer distance of each band but the last, which extends to infinity.
+	float lod_band_distance_squared[MAX_LOD_BANDS - 1];
+	// Fraction of the drops inside each band that are drawn.
+	float lod_band_density[MAX_LOD_BANDS];
+};
+
+// How a kernel template treats one of its features: compiled out, compiled in, or looked up from the
+// kernel's parameters as it goes. The first two make the specialised variants a dispatcher picks once per
+// pass; the last is the generic kernel, which handles every setting and is what they are measured against.
+enum PrecipitationKernelFeature {
+	PRECIPITATION_FEATURE_OFF,
+	PRECIPITATION_FEATURE_ON,
+	PRECIPITATION_FEATURE_DYNAMIC
+};
+
+template <int FEATURE>
+static _FORCE_INLINE_ bool precipitation_feature_enabled(bool p_enabled) {
+	return FEATURE == PRECIPITATION_FEATURE_DYNAMIC ? p_enabled : FEATURE == PRECIPITATION_FEATURE_ON;
+}
+
+// Integrates particles [p_from, p_to) by one step and wraps them back into the box without branching.
+// Particles that left the box are appended to r_wrapped (the return value is how many were appended) so the
+// caller can give them a new cutoff point; those that fell through the floor additionally get FLAG_RESPAWN.
+// Particles that dropped below their hit height lose FLAG_VALID, and the ones that were still valid are
+// appended to r_impacts, counting up r_impact_count.
+uint32_t precipitation_integrate_and_wrap(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const PrecipitationStepParams &p_params, uint32_t *r_wrapped, uint32_t *r_impacts, uint32_t *r_impact_count);
+
+// Reference implementation of the above, processing one particle at a time. The vector paths fall back to it
+// for the tail of the range and on targets without SSE2.
+uint32_t precipitation_integrate_and_wrap_scalar(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const PrecipitationStepParams &p_params, uint32_t *r_wrapped, uint32_t *r_impacts, uint32_t *r_impact_count);
+
+// How many particles the vector path of precipitation_integrate_and_wrap() takes at a time in this build: 8
+// with AVX, 4 with SSE2, or 1 where it only has the scalar loop.
+int precipitation_get_integrate_width();
+
+// Moves particles [p_from, p_to) by their own wind, sampled per particle into p_wind_x/y/z (indexed like the
+// pool), times p_scale and their inverse mass. Run before precipitation_integrate_and_wrap(), which adds the
+// shared wind and does the wrapping.
+void precipitation_apply_wind(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, const float *p_wind_x, const float *p_wind_y, const float *p_wind_z, float p_scale);
+
+// Sets FLAG_RENDER on particles [p_from, p_to) whose quad may be visible and clears it on the rest, and
+// stores each particle's level of detail band. A band only draws the drops whose index ranks below its
+// density, which keeps the selection stable from frame to frame; ranks come from the index plus
+// p_index_offset, so a pool viewing part of a larger one ranks its drops as that one would. Visible, valid
+// drops are counted per band into r_band_counts and the total is returned. The loop is branch-free so the
+// compiler can vectorise it.
+uint32_t precipitation_cull(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, uint32_t p_index_offset, const PrecipitationCullParams &p_params, uint32_t *r_band_counts);
+
+typedef uint32_t (*PrecipitationCullFunction)(PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to, uint32_t p_index_offset, const PrecipitationCullParams &p_params, uint32_t *r_band_counts);
+
+// A variant of precipitation_cull() with the distance limit and the level of detail bands compiled in or
+// out to match p_params, which it gives the same results for until the limit or the bands change.
+PrecipitationCullFunction precipitation_get_cull_function(const PrecipitationCullParams &p_params);
+
+#endif // PRECIPITATION_KERNELS_H
@@ -0,0 +1,121 @@
+#include "precipitation_mesh_builder.h"
+
+void PrecipitationMeshBuilder::_thread_func(void *p_self) {
+	PrecipitationMeshBuilder *self = (PrecipitationMeshBuilder *)p_self;
+
+	while (true) {
+		self->start->wait();
+		if (self->exit)
+			break;
+
+		for (int i = 0; i < self->job_count; i++) {
+			build_job(self->job_list[i]);
+		}
+
+		self->finished->post();
+	}
+}
+
+template <int BILLBOARDS, int COLORS>
+void PrecipitationMeshBuilder::_build_quads(Job *p_job) {
+	const PrecipitationQuadParams &params = p_job->params;
+	const PrecipitationParticlePool &drops = p_job->drops;
+	uint32_t count = drops.size();
+
+	Vector3 *vertex = p_job->vertices;
+	Vector2 *uv = p_job->uvs;
+	Color *color = p_job->colors;
+
+	for (uint32_t i = 0; i < count; i++) {
+		Vector3 wind = p_job->wind_samples ? p_job->wind + p_job->wind_samples[i] : p_job->wind;
+		Vector3 position = Vector3(drops.position_x[i], drops.position_y[i], drops.position_z[i]);
+		precipitation_build_quad<BILLBOARDS, COLORS>(params, position, wind, drops.inv_mass[i], drops.velocity[i], drops.hit_height[i], drops.tex_coord_index[i], drops.lod_band[i], vertex, uv, color);
+
+		vertex += 4;
+		uv += 4;
+		if (precipitation_feature_enabled<COLORS>(params.using_colors))
+			color += 4;
+	}
+}
+
+void PrecipitationMeshBuilder::build_job(Job *p_job) {
+	const PrecipitationQuadParams &params = p_job->params;
+
+	if (!params.using_specialized_kernels)
+		_build_quads<PRECIPITATION_FEATURE_DYNAMIC, PRECIPITATION_FEATURE_DYNAMIC>(p_job);
+	else if (params.using_billboards && params.using_colors)
+		_build_quads<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_ON>(p_job);
+	else if (params.using_billboards)
+		_build_quads<PRECIPITATION_FEATURE_ON, PRECIPITATION_FEATURE_OFF>(p_job);
+	else if (params.using_colors)
+		_build_quads<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_ON>(p_job);
+	else
+		_build_quads<PRECIPITATION_FEATURE_OFF, PRECIPITATION_FEATURE_OFF>(p_job);
+}
+
+PrecipitationMeshBuilder::Job *PrecipitationMeshBuilder::add_job() {
+	ERR_FAIL_COND_V(running, NULL);
+
+	if (job_count == jobs.size())
+		jobs.push_back(memnew(Job));
+
+	Job *job = jobs[job_count++];
+	job->wind_samples = NULL;
+	job->vertices = NULL;
+	job->uvs = NULL;
+	job->colors = NULL;
+	return job;
+}
+
+void PrecipitationMeshBuilder::start_jobs() {
+	ERR_FAIL_COND(running);
+
+	if (job_count == 0)
+		return;
+
+	if (thread == NULL)
+		thread = Thread::create(_thread_func, this);
+
+	job_list = jobs.ptr();
+	running = true;
+	start->post();
+}
+
+void PrecipitationMeshBuilder::finish_jobs() {
+	if (running) {
+		finished->wait();
+		running = false;
+	}
+
+	job_count = 0;
+}
+
+PrecipitationMeshBuilder::PrecipitationMeshBuilder() {
+	thread = NULL;
+	start = Semaphore::create();
+	finished = Semaphore::create();
+	exit = false;
+	running = false;
+
+	job_count = 0;
+	job_list = NULL;
+}
+
+PrecipitationMeshBuilder::~PrecipitationMeshBuilder() {
+	if (running)
+		finished->wait();
+
+	if (thread) {
+		exit = true;
+		start->post();
+		Thread::wait_to_finish(thread);
+		memdelete(thread);
+	}
+
+	memdelete(start);
+	memdelete(finished);
+
+	for (int i = 0; i < jobs.size(); i++) {
+		memdelete(jobs[i]);
+	}
+}
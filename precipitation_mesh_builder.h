@@ -0,0 +1,146 @@
+#ifndef PRECIPITATION_MESH_BUILDER_H
+#define PRECIPITATION_MESH_BUILDER_H
+
+#include "color.h"
+#include "math_2d.h"
+#include "vector.h"
+#include "vector3.h"
+#include "os/semaphore.h"
+#include "os/thread.h"
+#include "precipitation_kernels.h"
+
+// How a view turns drops into quads; the same for every drop it draws.
+struct PrecipitationQuadParams {
+	Vector3 camera_origin;
+	// Billboard axes scaled by the drop size, only used with billboards.
+	Vector3 right;
+	Vector3 up;
+	float drop_size;
+	bool using_billboards;
+	bool using_colors;
+	// Reference steps the drops are moved on from where they were simulated.
+	float render_offset;
+	// Four texture coordinates per atlas cell.
+	const Vector2 *coordinates;
+	float lod_band_scale[PrecipitationCullParams::MAX_LOD_BANDS];
+	float lod_band_alpha[PrecipitationCullParams::MAX_LOD_BANDS];
+	// False draws with the generic kernel, which looks up using_billboards and using_colors for every drop.
+	bool using_specialized_kernels;
+};
+
+// Writes the four corners of one drop's quad, moved on by the render offset and kept above its cutoff, at
+// r_vertex, r_uv and, with colors, r_color. BILLBOARDS and COLORS are PrecipitationKernelFeature values; the
+// dispatching loops instantiate it once per combination of using_billboards and using_colors.
+template <int BILLBOARDS, int COLORS>
+static _FORCE_INLINE_ void precipitation_build_quad(const PrecipitationQuadParams &p_params, Vector3 p_position, const Vector3 &p_wind, float p_inv_mass, float p_speed, float p_hit_height, uint32_t p_tex_coord_index, uint8_t p_band, Vector3 *r_vertex, Vector2 *r_uv, Color *r_color) {
+	Vector3 velocity = p_wind * p_inv_mass - Vector3(0, p_speed, 0);
+	p_position += velocity * p_params.render_offset;
+	p_position.y = MAX(p_position.y, p_hit_height);
+
+	Vector3 right = p_params.right;
+	Vector3 up = p_params.up;
+
+	if (!precipitation_feature_enabled<BILLBOARDS>(p_params.using_billboards)) {
+		Vector3 ortho_dir = p_params.camera_origin;
+		ortho_dir.y = p_position.y;
+		ortho_dir -= p_position;
+		float distance = ortho_dir.length();
+
+		if (distance > 0.0)
+			ortho_dir *= -1.0 / distance;
+		else
+			ortho_dir = -Vector3(0, 0, 1);
+
+		Vector3 direction = p_wind * p_inv_mass;
+		direction.z -= p_speed;
+		direction = direction.normalized();
+
+		up = (-direction.cross(ortho_dir)).normalized() * p_params.drop_size;
+		right = (ortho_dir.cross(up) - direction).normalized() * p_params.drop_size;
+	}
+
+	float scale = p_params.lod_band_scale[p_band];
+	Vector3 right_up = (right + up) * scale;
+	Vector3 left_up = (up - right) * scale;
+
+	r_vertex[0] = p_position + left_up;
+	r_vertex[1] = p_position + right_up;
+	r_vertex[2] = p_position - right_up;
+	r_vertex[3] = p_position - left_up;
+
+	const Vector2 *quad_uv = p_params.coordinates + p_tex_coord_index * 4;
+	r_uv[0] = quad_uv[0];
+	r_uv[1] = quad_uv[1];
+	r_uv[2] = quad_uv[2];
+	r_uv[3] = quad_uv[3];
+
+	if (precipitation_feature_enabled<COLORS>(p_params.using_colors)) {
+		Color band_color = Color(1, 1, 1, p_params.lod_band_alpha[p_band]);
+		r_color[0] = band_color;
+		r_color[1] = band_color;
+		r_color[2] = band_color;
+		r_color[3] = band_color;
+	}
+}
+
+// Builds drop quads on a background thread, a frame behind the simulation. The main thread gathers the drops
+// each view draws into a job, with raw pointers to arrays it has sized and locked for the quads, and starts
+// the batch; the worker only reads the jobs and writes those arrays, so nothing is shared while it runs. The
+// main thread collects the batch on the next frame and only waits if the worker is still going.
+
+class PrecipitationMeshBuilder {
+public:
+	struct Job {
+		PrecipitationQuadParams params;
+
+		// The drops to draw, packed from zero.
+		PrecipitationParticlePool drops;
+		Vector3 wind;
+		// Each drop's wind field sample, added to wind; NULL without a wind field.
+		const Vector3 *wind_samples;
+		Vector<Vector3> wind_sample_storage;
+		// Atlas coordinates, held so the worker's pointer stays valid if the emitter rebuilds its own.
+		Vector<Vector2> coordinate_storage;
+
+		Vector3 *vertices;
+		Vector2 *uvs;
+		Color *colors;
+	};
+
+private:
+	Thread *thread;
+	Semaphore *start;
+	Semaphore *finished;
+	bool exit;
+	bool running;
+
+	Vector<Job *> jobs;
+	int job_count;
+	// What the worker walks, so it never touches the Vector's reference count.
+	Job **job_list;
+
+	static void _thread_func(void *p_self);
+
+	template <int BILLBOARDS, int COLORS>
+	static void _build_quads(Job *p_job);
+
+public:
+	// A job for this batch, reused from an earlier one where possible.
+	Job *add_job();
+	// Hands the jobs added since the last batch to the worker.
+	void start_jobs();
+	// Waits for the batch in flight, if any, after which its arrays are complete and the jobs can be reused.
+	void finish_jobs();
+
+	// Builds the job's quads with the kernel matching its parameters.
+	static void build_job(Job *p_job);
+
+	_FORCE_INLINE_ bool is_busy() const {
+		return running;
+	}
+
+	PrecipitationMeshBuilder();
+	~PrecipitationMeshBuilder();
+};
+
+#endif // PRECIPITATION_MESH_BUILDER_H
@@ -0,0 +1,154 @@
+#include "precipitation_occlusion_cache.h"
+
+const float PrecipitationOcclusionCache::EMPTY_HEIGHT = -1000;
+
+void PrecipitationOcclusionCache::configure(float p_cell_size, int p_resolution, const Vector3 &p_direction, float p_reference_height, float p_ray_length) {
+	p_resolution = MAX(p_resolution, 1);
+
+	bool changed = p_cell_size != cell_size ||
+				   p_resolution != resolution ||
+				   p_reference_height != reference_height ||
+				   p_ray_length != ray_length ||
+				   p_direction.dot(direction) < 0.9999;
+
+	if (!changed)
+		return;
+
+	cell_size = p_cell_size;
+	resolution = p_resolution;
+	direction = p_direction;
+	reference_height = p_reference_height;
+	ray_length = p_ray_length;
+
+	cells.resize(resolution * resolution);
+	invalidate();
+}
+
+void PrecipitationOcclusionCache::invalidate() {
+	for (int i = 0; i < cells.size(); i++) {
+		cells[i].state = STATE_EMPTY;
+	}
+	queue.clear();
+	queue_head = 0;
+}
+
+bool PrecipitationOcclusionCache::lookup(const Vector3 &p_position, const Vector3 &p_direction, float &r_height) {
+	r_height = EMPTY_HEIGHT;
+
+	// Nothing above stops a drop that is not falling, and its column would never resolve.
+	if (p_direction.y >= 0.0)
+		return true;
+
+	if (cells.empty())
+		return false;
+
+	// Follow the particle's path back up to the reference plane to find the column it is falling through.
+	float t = (reference_height - p_position.y) / p_direction.y;
+	int32_t x = (int32_t)Math::floor((p_position.x + p_direction.x * t) / cell_size);
+	int32_t z = (int32_t)Math::floor((p_position.z + p_direction.z * t) / cell_size);
+
+	uint32_t slot = _get_slot(x, z);
+	Cell &cell = cells[slot];
+
+	if (cell.state == STATE_READY && cell.x == x && cell.z == z) {
+		r_height = cell.height;
+		return true;
+	}
+
+	if (cell.state == STATE_EMPTY || cell.x != x || cell.z != z) {
+		// The box moved onto a new cell that maps to this slot; requeue it under its new coordinate.
+		bool already_queued = cell.state == STATE_QUEUED;
+		cell.x = x;
+		cell.z = z;
+		cell.state = STATE_QUEUED;
+		if (!already_queued)
+			queue.push_back(slot);
+	}
+
+	for (int32_t nz = z - 1; nz <= z + 1; nz++) {
+		for (int32_t nx = x - 1; nx <= x + 1; nx++) {
+			const Cell &neighbour = cells[_get_slot(nx, nz)];
+			if (neighbour.state == STATE_READY && neighbour.x == nx && neighbour.z == nz)
+				r_height = MAX(r_height, neighbour.height);
+		}
+	}
+
+	return false;
+}
+
+int PrecipitationOcclusionCache::process_queue(PhysicsDirectSpaceState *p_space, uint32_t p_collision_mask, int p_budget) {
+	int raycasts = 0;
+	RayRequest request;
+
+	while (raycasts < p_budget && dequeue_requests(&request, 1)) {
+		PhysicsDirectSpaceState::RayResult rr;
+		if (p_space && p_space->intersect_ray(request.from, request.to, rr, exclude, p_collision_mask, PhysicsDirectSpaceState::TYPE_MASK_STATIC_BODY))
+			request.height = rr.position.y;
+		else
+			request.height = EMPTY_HEIGHT;
+
+		apply_results(&request, 1);
+		raycasts++;
+	}
+
+	return raycasts;
+}
+
+int PrecipitationOcclusionCache::dequeue_requests(RayRequest *r_requests, int p_max) {
+	int count = 0;
+
+	while (queue_head < queue.size() && count < p_max) {
+		uint32_t slot = queue[queue_head++];
+		Cell &cell = cells[slot];
+		if (cell.state != STATE_QUEUED)
+			continue;
+
+		RayRequest &request = r_requests[count++];
+		request.slot = slot;
+		request.x = cell.x;
+		request.z = cell.z;
+		request.from = Vector3((cell.x + 0.5) * cell_size, reference_height, (cell.z + 0.5) * cell_size);
+		request.to = request.from + direction * ray_length;
+		request.height = EMPTY_HEIGHT;
+
+		cell.state = STATE_IN_FLIGHT;
+	}
+
+	if (queue_head >= queue.size()) {
+		queue.clear();
+		queue_head = 0;
+	} else if (queue_head * 2 > queue.size()) {
+		// Drop the consumed front so a queue that never fully drains does not grow without bound.
+		int remaining = queue.size() - queue_head;
+		for (int i = 0; i < remaining; i++) {
+			queue[i] = queue[queue_head + i];
+		}
+		queue.resize(remaining);
+		queue_head = 0;
+	}
+
+	return count;
+}
+
+void PrecipitationOcclusionCache::apply_results(const RayRequest *p_requests, int p_count) {
+	for (int i = 0; i < p_count; i++) {
+		const RayRequest &request = p_requests[i];
+		if (request.slot >= (uint32_t)cells.size())
+			continue;
+
+		Cell &cell = cells[request.slot];
+		if (cell.state != STATE_IN_FLIGHT || cell.x != request.x || cell.z != request.z)
+			continue;
+
+		cell.height = request.height;
+		cell.state = STATE_READY;
+	}
+}
+
+PrecipitationOcclusionCache::PrecipitationOcclusionCache() {
+	queue_head = 0;
+	cell_size = 0;
+	resolution = 0;
+	reference_height = 0;
+	ray_length = 0;
+}
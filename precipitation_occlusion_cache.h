@@ -0,0 +1,86 @@
+#ifndef PRECIPITATION_OCCLUSION_CACHE_H
+#define PRECIPITATION_OCCLUSION_CACHE_H
+
+#include "servers/physics_server.h"
+
+// Heightfield of the highest blocking surface over the precipitation box. Cells live on a horizontal
+// reference plane above the box and each one stores where a ray cast from it along the mean fall
+// direction first hits static geometry, so the grid is effectively sheared along the wind. Slots are
+// addressed toroidally by world cell coordinate, so moving the box only invalidates the cells it moves
+// into. Unknown cells are queued and filled by a fixed number of raycasts per frame, either here or by
+// whoever takes them off the queue as ray requests and hands the results back.
+
+class PrecipitationOcclusionCache {
+public:
+	enum {
+		STATE_EMPTY,
+		STATE_QUEUED,
+		STATE_IN_FLIGHT,
+		STATE_READY,
+	};
+
+	struct RayRequest {
+		uint32_t slot;
+		int32_t x;
+		int32_t z;
+		Vector3 from;
+		Vector3 to;
+		float height;
+	};
+
+private:
+	struct Cell {
+		int32_t x;
+		int32_t z;
+		float height;
+		uint8_t state;
+	};
+
+	Vector<Cell> cells;
+	Vector<uint32_t> queue;
+	int queue_head;
+
+	float cell_size;
+	int resolution;
+	Vector3 direction;
+	float reference_height;
+	float ray_length;
+
+	Set<RID> exclude;
+
+	_FORCE_INLINE_ uint32_t _get_slot(int32_t p_x, int32_t p_z) const {
+		int32_t sx = p_x % resolution;
+		int32_t sz = p_z % resolution;
+		if (sx < 0)
+			sx += resolution;
+		if (sz < 0)
+			sz += resolution;
+		return sz * resolution + sx;
+	}
+
+public:
+	// Height reported for columns where nothing was hit.
+	static const float EMPTY_HEIGHT;
+
+	void configure(float p_cell_size, int p_resolution, const Vector3 &p_direction, float p_reference_height, float p_ray_length);
+	void invalidate();
+
+	// On a miss r_height is still set, to the highest ready neighbouring column or EMPTY_HEIGHT, so a drop
+	// waiting on its column errs towards stopping early rather than falling through a roof. Drops that are
+	// not falling always hit, at EMPTY_HEIGHT.
+	bool lookup(const Vector3 &p_position, const Vector3 &p_direction, float &r_height);
+	int process_queue(PhysicsDirectSpaceState *p_space, uint32_t p_collision_mask, int p_budget);
+
+	// Takes up to p_max queued cells off the queue; they stay in flight until apply_results() sees them.
+	int dequeue_requests(RayRequest *r_requests, int p_max);
+	// Results for cells that were re-targeted or invalidated meanwhile are dropped.
+	void apply_results(const RayRequest *p_requests, int p_count);
+
+	_FORCE_INLINE_ int get_queued_count() const {
+		return queue.size() - queue_head;
+	}
+
+	PrecipitationOcclusionCache();
+};
+
+#endif // PRECIPITATION_OCCLUSION_CACHE_H
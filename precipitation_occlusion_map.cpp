@@ -0,0 +1,422 @@
+#include "precipitation_occlusion_map.h"
+#include "precipitation_collision_snapshot.h"
+#include "precipitation_occlusion_cache.h"
+#include "os/dir_access.h"
+
+void PrecipitationOcclusionMap::_set_layout(const AABB &p_bounds, float p_cell_size) {
+	bounds = p_bounds;
+	cell_size = p_cell_size;
+	height_step = bounds.size.y / 65534.0f;
+	cells_x = MAX((int)Math::ceil(bounds.size.x / cell_size), 1);
+	cells_z = MAX((int)Math::ceil(bounds.size.z / cell_size), 1);
+	tiles_x = (cells_x + TILE_CELLS - 1) / TILE_CELLS;
+	tiles_z = (cells_z + TILE_CELLS - 1) / TILE_CELLS;
+}
+
+void PrecipitationOcclusionMap::_close_file() {
+	if (file) {
+		file->close();
+		memdelete(file);
+		file = NULL;
+		file_path = String();
+	}
+
+	slot_cells.clear();
+	slot_tile.clear();
+	slot_used.clear();
+	tile_slot.clear();
+}
+
+void PrecipitationOcclusionMap::_reset_slots() {
+	slot_cells.resize(max_resident_tiles * TILE_CELL_COUNT);
+	slot_tile.resize(max_resident_tiles);
+	slot_used.resize(max_resident_tiles);
+	for (int i = 0; i < max_resident_tiles; i++) {
+		slot_tile[i] = -1;
+		slot_used[i] = 0;
+	}
+
+	tile_slot.resize(tiles_x * tiles_z);
+	for (int i = 0; i < tile_slot.size(); i++) {
+		tile_slot[i] = -1;
+	}
+
+	use_counter = 0;
+}
+
+const uint16_t *PrecipitationOcclusionMap::_get_tile(int p_tile) {
+	uint32_t entry = tile_directory[p_tile];
+	if (entry == 0)
+		return NULL;
+
+	if (!file)
+		return baked_cells.ptr() + (entry - 1) * TILE_CELL_COUNT;
+
+	int slot = tile_slot[p_tile];
+	if (slot < 0) {
+		// Unused slots have never been touched, so this takes one of those first.
+		slot = 0;
+		for (int i = 1; i < max_resident_tiles; i++) {
+			if (slot_used[i] < slot_used[slot])
+				slot = i;
+		}
+
+		if (slot_tile[slot] >= 0)
+			tile_slot[slot_tile[slot]] = -1;
+
+		uint16_t *cells = slot_cells.ptr() + slot * TILE_CELL_COUNT;
+		file->seek(file_data_offset + (size_t)(entry - 1) * TILE_CELL_COUNT * sizeof(uint16_t));
+		int read = file->get_buffer((uint8_t *)cells, TILE_CELL_COUNT * sizeof(uint16_t)) / sizeof(uint16_t);
+
+		// A truncated file leaves the rest of the tile blocking nothing.
+		for (int i = MAX(read, 0); i < TILE_CELL_COUNT; i++) {
+			cells[i] = 0;
+		}
+#ifdef BIG_ENDIAN_ENABLED
+		for (int i = 0; i < TILE_CELL_COUNT; i++) {
+			cells[i] = (cells[i] >> 8) | (cells[i] << 8);
+		}
+#endif
+
+		slot_tile[slot] = p_tile;
+		tile_slot[p_tile] = slot;
+	}
+
+	slot_used[slot] = ++use_counter;
+	return slot_cells.ptr() + slot * TILE_CELL_COUNT;
+}
+
+bool PrecipitationOcclusionMap::_sample(float p_x, float p_z, float &r_height) {
+	if (tile_directory.empty())
+		return false;
+
+	int x = (int)Math::floor((p_x - bounds.pos.x) / cell_size);
+	int z = (int)Math::floor((p_z - bounds.pos.z) / cell_size);
+	if (x < 0 || z < 0 || x >= cells_x || z >= cells_z)
+		return false;
+
+	const uint16_t *tile = _get_tile((z / TILE_CELLS) * tiles_x + x / TILE_CELLS);
+	uint16_t value = tile ? tile[(z % TILE_CELLS) * TILE_CELLS + x % TILE_CELLS] : 0;
+
+	r_height = value ? bounds.pos.y + (value - 1) * height_step : PrecipitationOcclusionCache::EMPTY_HEIGHT;
+	return true;
+}
+
+Error PrecipitationOcclusionMap::bake(Object *p_space_state, const AABB &p_bounds, float p_cell_size, int p_collision_mask) {
+	PhysicsDirectSpaceState *space = p_space_state ? p_space_state->cast_to<PhysicsDirectSpaceState>() : NULL;
+	ERR_FAIL_COND_V(!space, ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V(p_cell_size <= 0, ERR_INVALID_PARAMETER);
+	ERR_FAIL_COND_V(p_bounds.size.x <= 0 || p_bounds.size.y <= 0 || p_bounds.size.z <= 0, ERR_INVALID_PARAMETER);
+
+	_close_file();
+	_set_layout(p_bounds, p_cell_size);
+
+	tile_directory.resize(tiles_x * tiles_z);
+	baked_cells.clear();
+	stored_tile_count = 0;
+
+	float top = bounds.pos.y + bounds.size.y;
+	float bottom = bounds.pos.y;
+	float tile_size = TILE_CELLS * cell_size;
+
+	PrecipitationCollisionSnapshot snapshot;
+	uint16_t cells[TILE_CELL_COUNT];
+
+	for (int tz = 0; tz < tiles_z; tz++) {
+		for (int tx = 0; tx < tiles_x; tx++) {
+			// A little taller than the bounds, so shapes lying flush with the top or bottom are still captured.
+			Vector3 tile_pos = Vector3(bounds.pos.x + tx * tile_size, bottom - 1, bounds.pos.z + tz * tile_size);
+			snapshot.capture(space, AABB(tile_pos, Vector3(tile_size, bounds.size.y + 2, tile_size)), p_collision_mask, Set<RID>());
+
+			bool blocking = false;
+			for (int z = 0; z < TILE_CELLS; z++) {
+				for (int x = 0; x < TILE_CELLS; x++) {
+					int cell_x = tx * TILE_CELLS + x;
+					int cell_z = tz * TILE_CELLS + z;
+
+					uint16_t value = 0;
+					if (cell_x < cells_x && cell_z < cells_z) {
+						Vector3 from = Vector3(bounds.pos.x + (cell_x + 0.5) * cell_size, top, bounds.pos.z + (cell_z + 0.5) * cell_size);
+						Vector3 position;
+						if (snapshot.intersect_segment(from, Vector3(from.x, bottom, from.z), position))
+							value = (uint16_t)CLAMP((position.y - bottom) / height_step + 1.5f, 1.0f, 65535.0f);
+					}
+
+					cells[z * TILE_CELLS + x] = value;
+					blocking = blocking || value != 0;
+				}
+			}
+
+			int tile = tz * tiles_x + tx;
+			if (!blocking) {
+				tile_directory[tile] = 0;
+				continue;
+			}
+
+			int offset = baked_cells.size();
+			baked_cells.resize(offset + TILE_CELL_COUNT);
+			copymem(baked_cells.ptr() + offset, cells, sizeof(cells));
+
+			stored_tile_count++;
+			tile_directory[tile] = stored_tile_count;
+		}
+	}
+
+	emit_changed();
+	return OK;
+}
+
+Error PrecipitationOcclusionMap::save_file(const String &p_path) {
+	ERR_FAIL_COND_V(tile_directory.empty(), ERR_UNCONFIGURED);
+
+	// A loaded map still reads its tiles from its file, which may be the one being replaced, so the new file
+	// is written next to it and only moved over the old one once complete.
+	String temp_path = p_path + ".tmp";
+	Error err;
+	FileAccess *f = FileAccess::open(temp_path, FileAccess::WRITE, &err);
+	ERR_FAIL_COND_V(!f, err);
+
+	f->store_buffer((const uint8_t *)"PCOM", 4);
+	f->store_32(FORMAT_VERSION);
+
+	f->store_float(bounds.pos.x);
+	f->store_float(bounds.pos.y);
+	f->store_float(bounds.pos.z);
+	f->store_float(bounds.size.x);
+	f->store_float(bounds.size.y);
+	f->store_float(bounds.size.z);
+	f->store_float(cell_size);
+	f->store_32(tiles_x);
+	f->store_32(tiles_z);
+	f->store_32(stored_tile_count);
+
+	Vector<int> stored_tiles;
+	stored_tiles.resize(stored_tile_count);
+	for (int i = 0; i < tile_directory.size(); i++) {
+		f->store_32(tile_directory[i]);
+		if (tile_directory[i])
+			stored_tiles[tile_directory[i] - 1] = i;
+	}
+
+	for (int i = 0; i < stored_tiles.size(); i++) {
+		const uint16_t *cells = _get_tile(stored_tiles[i]);
+		for (int j = 0; j < TILE_CELL_COUNT; j++) {
+			f->store_16(cells[j]);
+		}
+	}
+
+	f->close();
+	memdelete(f);
+
+	// Some platforms will not replace a file that is open, so the map lets go of its own and opens it again
+	// afterwards, which is the new one when it was saved over itself.
+	String reopen_path = file ? file_path : String();
+	_close_file();
+
+	DirAccess *da = DirAccess::create_for_path(p_path);
+	err = da->rename(temp_path, p_path);
+	if (err != OK)
+		da->remove(temp_path);
+	memdelete(da);
+
+	if (!reopen_path.empty()) {
+		Error reopen_err = open_file(reopen_path);
+		ERR_FAIL_COND_V(reopen_err != OK, reopen_err);
+	}
+
+	ERR_FAIL_COND_V(err != OK, err);
+	return OK;
+}
+
+Error PrecipitationOcclusionMap::open_file(const String &p_path) {
+	Error err;
+	FileAccess *f = FileAccess::open(p_path, FileAccess::READ, &err);
+	ERR_FAIL_COND_V(!f, err);
+
+	uint8_t magic[4];
+	f->get_buffer(magic, 4);
+	uint32_t version = f->get_32();
+	if (magic[0] != 'P' || magic[1] != 'C' || magic[2] != 'O' || magic[3] != 'M' || version != FORMAT_VERSION) {
+		f->close();
+		memdelete(f);
+		ERR_EXPLAIN("Not an occlusion map, or one from another version: " + p_path);
+		ERR_FAIL_V(ERR_FILE_UNRECOGNIZED);
+	}
+
+	AABB file_bounds;
+	file_bounds.pos.x = f->get_float();
+	file_bounds.pos.y = f->get_float();
+	file_bounds.pos.z = f->get_float();
+	file_bounds.size.x = f->get_float();
+	file_bounds.size.y = f->get_float();
+	file_bounds.size.z = f->get_float();
+	float file_cell_size = f->get_float();
+	int file_tiles_x = f->get_32();
+	int file_tiles_z = f->get_32();
+	int file_stored_tile_count = f->get_32();
+
+	_close_file();
+	baked_cells.clear();
+	tile_directory.clear();
+	stored_tile_count = 0;
+
+	bool valid = file_cell_size > 0 && file_bounds.size.x > 0 && file_bounds.size.y > 0 && file_bounds.size.z > 0;
+	if (valid) {
+		_set_layout(file_bounds, file_cell_size);
+		valid = tiles_x == file_tiles_x && tiles_z == file_tiles_z && file_stored_tile_count >= 0 && file_stored_tile_count <= tiles_x * tiles_z;
+	}
+
+	if (valid) {
+		tile_directory.resize(tiles_x * tiles_z);
+		for (int i = 0; i < tile_directory.size(); i++) {
+			tile_directory[i] = f->get_32();
+			valid = valid && tile_directory[i] <= (uint32_t)file_stored_tile_count;
+		}
+
+		file_data_offset = f->get_pos();
+		valid = valid && !f->eof_reached() && f->get_len() >= file_data_offset + (size_t)file_stored_tile_count * TILE_CELL_COUNT * sizeof(uint16_t);
+	}
+
+	if (!valid) {
+		f->close();
+		memdelete(f);
+		tile_directory.clear();
+		ERR_EXPLAIN("Corrupt occlusion map: " + p_path);
+		ERR_FAIL_V(ERR_FILE_CORRUPT);
+	}
+
+	// The tiles stay in the file until a drop needs them.
+	stored_tile_count = file_stored_tile_count;
+	file = f;
+	file_path = p_path;
+	_reset_slots();
+
+	emit_changed();
+	return OK;
+}
+
+bool PrecipitationOcclusionMap::get_cutoff_height(const Vector3 &p_position, const Vector3 &p_direction, float &r_height) {
+	float height;
+	if (!_sample(p_position.x, p_position.z, height))
+		return false;
+
+	// A slanted drop is stopped further along its path; follow it down to the height found so far and look
+	// again there. Two rounds settle it for the gentle slopes wind gives.
+	if (p_direction.y < -CMP_EPSILON) {
+		float slope_x = p_direction.x / -p_direction.y;
+		float slope_z = p_direction.z / -p_direction.y;
+
+		for (int i = 0; i < 2; i++) {
+			float fall = MAX(p_position.y - MAX(height, bounds.pos.y), 0.0f);
+			if (!_sample(p_position.x + slope_x * fall, p_position.z + slope_z * fall, height))
+				return false;
+		}
+	}
+
+	r_height = height;
+	return true;
+}
+
+float PrecipitationOcclusionMap::get_height(const Vector3 &p_position) {
+	float height;
+	if (!_sample(p_position.x, p_position.z, height))
+		return PrecipitationOcclusionCache::EMPTY_HEIGHT;
+
+	return height;
+}
+
+void PrecipitationOcclusionMap::set_max_resident_tiles(int p_max_resident_tiles) {
+	max_resident_tiles = MAX(p_max_resident_tiles, 1);
+
+	if (file)
+		_reset_slots();
+}
+
+int PrecipitationOcclusionMap::get_resident_tile_count() const {
+	if (!file)
+		return stored_tile_count;
+
+	int count = 0;
+	for (int i = 0; i < slot_tile.size(); i++) {
+		if (slot_tile[i] >= 0)
+			count++;
+	}
+
+	return count;
+}
+
+void PrecipitationOcclusionMap::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("bake", "space_state:PhysicsDirectSpaceState", "bounds", "cell_size", "collision_mask"), &PrecipitationOcclusionMap::bake);
+	ObjectTypeDB::bind_method(_MD("save_file", "path"), &PrecipitationOcclusionMap::save_file);
+	ObjectTypeDB::bind_method(_MD("open_file", "path"), &PrecipitationOcclusionMap::open_file);
+
+	ObjectTypeDB::bind_method(_MD("get_height", "position"), &PrecipitationOcclusionMap::get_height);
+	ObjectTypeDB::bind_method(_MD("get_bounds"), &PrecipitationOcclusionMap::get_bounds);
+	ObjectTypeDB::bind_method(_MD("get_cell_size"), &PrecipitationOcclusionMap::get_cell_size);
+	ObjectTypeDB::bind_method(_MD("get_tile_count"), &PrecipitationOcclusionMap::get_tile_count);
+	ObjectTypeDB::bind_method(_MD("get_stored_tile_count"), &PrecipitationOcclusionMap::get_stored_tile_count);
+
+	ObjectTypeDB::bind_method(_MD("set_max_resident_tiles", "max_resident_tiles"), &PrecipitationOcclusionMap::set_max_resident_tiles);
+	ObjectTypeDB::bind_method(_MD("get_max_resident_tiles"), &PrecipitationOcclusionMap::get_max_resident_tiles);
+	ObjectTypeDB::bind_method(_MD("get_resident_tile_count"), &PrecipitationOcclusionMap::get_resident_tile_count);
+}
+
+PrecipitationOcclusionMap::PrecipitationOcclusionMap() {
+	cell_size = 1;
+	height_step = 0;
+	cells_x = 0;
+	cells_z = 0;
+	tiles_x = 0;
+	tiles_z = 0;
+	stored_tile_count = 0;
+
+	file = NULL;
+	file_data_offset = 0;
+	max_resident_tiles = 64;
+	use_counter = 0;
+}
+
+PrecipitationOcclusionMap::~PrecipitationOcclusionMap() {
+	_close_file();
+}
+
+RES ResourceFormatLoaderPrecipitationOcclusionMap::load(const String &p_path, const String &p_original_path, Error *r_error) {
+	Ref<PrecipitationOcclusionMap> map = memnew(PrecipitationOcclusionMap);
+	Error err = map->open_file(p_path);
+	if (r_error)
+		*r_error = err;
+	if (err != OK)
+		return RES();
+
+	return map;
+}
+
+void ResourceFormatLoaderPrecipitationOcclusionMap::get_recognized_extensions(List<String> *p_extensions) const {
+	p_extensions->push_back("pomap");
+}
+
+bool ResourceFormatLoaderPrecipitationOcclusionMap::handles_type(const String &p_type) const {
+	return p_type == "PrecipitationOcclusionMap";
+}
+
+String ResourceFormatLoaderPrecipitationOcclusionMap::get_resource_type(const String &p_path) const {
+	if (p_path.extension().to_lower() == "pomap")
+		return "PrecipitationOcclusionMap";
+	return "";
+}
+
+Error ResourceFormatSaverPrecipitationOcclusionMap::save(const String &p_path, const RES &p_resource, uint32_t p_flags) {
+	Ref<PrecipitationOcclusionMap> map = p_resource;
+	ERR_FAIL_COND_V(map.is_null(), ERR_INVALID_PARAMETER);
+
+	return map->save_file(p_path);
+}
+
+bool ResourceFormatSaverPrecipitationOcclusionMap::recognize(const RES &p_resource) const {
+	return p_resource.is_valid() && p_resource->cast_to<PrecipitationOcclusionMap>() != NULL;
+}
+
+void ResourceFormatSaverPrecipitationOcclusionMap::get_recognized_extensions(const RES &p_resource, List<String> *p_extensions) const {
+	if (recognize(p_resource))
+		p_extensions->push_back("pomap");
+}
@@ -0,0 +1,124 @@
+#ifndef PRECIPITATION_OCCLUSION_MAP_H
+#define PRECIPITATION_OCCLUSION_MAP_H
+
+#include "resource.h"
+#include "io/resource_loader.h"
+#include "io/resource_saver.h"
+#include "os/file_access.h"
+
+// Baked top blocking height of the static geometry over a level, per horizontal cell, so drops inside the
+// map get their cutoff without any physics queries. Heights are 16-bit steps over the baked bounds, with
+// zero for a column nothing blocks, in tiles of TILE_CELLS cells a side; tiles that block nothing are not
+// stored at all.
+//
+// A map loaded from a file keeps the file open and reads a tile only when a drop first needs it, straight
+// into one of a fixed number of slots, evicting the least recently used tile. Only the header and the tile
+// directory are read up front, so loading does not depend on the size of the level.
+//
+// File layout, little endian:
+//   magic "PCOM", version
+//   bounds (6 floats), cell size, tiles along x, tiles along z, stored tile count
+//   directory: per tile, one plus its position among the stored tiles, or zero
+//   stored tiles, TILE_CELLS * TILE_CELLS 16-bit heights each, rows along x
+class PrecipitationOcclusionMap : public Resource {
+
+	OBJ_TYPE(PrecipitationOcclusionMap, Resource);
+	RES_BASE_EXTENSION("pomap");
+
+public:
+	enum {
+		TILE_CELLS = 64,
+		TILE_CELL_COUNT = TILE_CELLS * TILE_CELLS,
+		FORMAT_VERSION = 1,
+	};
+
+private:
+	AABB bounds;
+	float cell_size;
+	float height_step;
+	int cells_x;
+	int cells_z;
+	int tiles_x;
+	int tiles_z;
+	int stored_tile_count;
+	Vector<uint32_t> tile_directory;
+
+	// Stored tiles of a map baked since it was loaded, or never saved.
+	Vector<uint16_t> baked_cells;
+
+	FileAccess *file;
+	String file_path;
+	size_t file_data_offset;
+	int max_resident_tiles;
+	Vector<uint16_t> slot_cells;
+	Vector<int> slot_tile;
+	Vector<uint32_t> slot_used;
+	Vector<int> tile_slot;
+	uint32_t use_counter;
+
+	void _set_layout(const AABB &p_bounds, float p_cell_size);
+	void _close_file();
+	void _reset_slots();
+	const uint16_t *_get_tile(int p_tile);
+	bool _sample(float p_x, float p_z, float &r_height);
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Casts a vertical ray per cell against the static bodies in p_collision_mask inside p_bounds, a tile at a
+	// time. p_space_state is a PhysicsDirectSpaceState; run from a tool script or the editor.
+	Error bake(Object *p_space_state, const AABB &p_bounds, float p_cell_size, int p_collision_mask);
+
+	Error save_file(const String &p_path);
+	Error open_file(const String &p_path);
+
+	// Where a drop at p_position falling along p_direction is stopped, or EMPTY_HEIGHT of the occlusion
+	// cache if nothing stops it. False if the path leaves the map, which is then no help.
+	bool get_cutoff_height(const Vector3 &p_position, const Vector3 &p_direction, float &r_height);
+	float get_height(const Vector3 &p_position);
+
+	_FORCE_INLINE_ AABB get_bounds() const {
+		return bounds;
+	}
+
+	_FORCE_INLINE_ float get_cell_size() const {
+		return cell_size;
+	}
+
+	_FORCE_INLINE_ int get_tile_count() const {
+		return tiles_x * tiles_z;
+	}
+
+	_FORCE_INLINE_ int get_stored_tile_count() const {
+		return stored_tile_count;
+	}
+
+	void set_max_resident_tiles(int p_max_resident_tiles);
+
+	_FORCE_INLINE_ int get_max_resident_tiles() const {
+		return max_resident_tiles;
+	}
+
+	int get_resident_tile_count() const;
+
+	PrecipitationOcclusionMap();
+	~PrecipitationOcclusionMap();
+};
+
+class ResourceFormatLoaderPrecipitationOcclusionMap : public ResourceFormatLoader {
+public:
+	virtual RES load(const String &p_path, const String &p_original_path = "", Error *r_error = NULL);
+	virtual void get_recognized_extensions(List<String> *p_extensions) const;
+	virtual bool handles_type(const String &p_type) const;
+	virtual String get_resource_type(const String &p_path) const;
+};
+
+class ResourceFormatSaverPrecipitationOcclusionMap : public ResourceFormatSaver {
+public:
+	virtual Error save(const String &p_path, const RES &p_resource, uint32_t p_flags = 0);
+	virtual bool recognize(const RES &p_resource) const;
+	virtual void get_recognized_extensions(const RES &p_resource, List<String> *p_extensions) const;
+};
+
+#endif // PRECIPITATION_OCCLUSION_MAP_H
@@ -0,0 +1,149 @@
+#include "precipitation_particle_pool.h"
+#include "os/memory.h"
+
+#define POOL_ARRAY_SIZE(m_type, m_capacity) ((sizeof(m_type) * (m_capacity) + PrecipitationParticlePool::ALIGNMENT - 1) & ~(size_t)(PrecipitationParticlePool::ALIGNMENT - 1))
+
+static size_t _pool_block_size(uint32_t p_capacity) {
+	return POOL_ARRAY_SIZE(float, p_capacity) * 6 +
+		   POOL_ARRAY_SIZE(uint32_t, p_capacity) +
+		   POOL_ARRAY_SIZE(uint8_t, p_capacity) * 2 +
+		   PrecipitationParticlePool::ALIGNMENT;
+}
+
+void PrecipitationParticlePool::_assign_arrays(uint8_t *p_block, uint32_t p_capacity) {
+	uint8_t *ptr = (uint8_t *)(((size_t)p_block + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1));
+
+	position_x = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	position_y = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	position_z = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	velocity = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	inv_mass = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	hit_height = (float *)ptr;
+	ptr += POOL_ARRAY_SIZE(float, p_capacity);
+	tex_coord_index = (uint32_t *)ptr;
+	ptr += POOL_ARRAY_SIZE(uint32_t, p_capacity);
+	flags = ptr;
+	ptr += POOL_ARRAY_SIZE(uint8_t, p_capacity);
+	lod_band = ptr;
+}
+
+void PrecipitationParticlePool::reserve(uint32_t p_capacity) {
+	p_capacity = (p_capacity + CAPACITY_GRANULARITY - 1) & ~(uint32_t)(CAPACITY_GRANULARITY - 1);
+	if (p_capacity <= capacity)
+		return;
+
+	uint8_t *new_block = (uint8_t *)memalloc(_pool_block_size(p_capacity));
+	ERR_FAIL_COND(!new_block);
+
+	float *old_position_x = position_x;
+	float *old_position_y = position_y;
+	float *old_position_z = position_z;
+	float *old_velocity = velocity;
+	float *old_inv_mass = inv_mass;
+	float *old_hit_height = hit_height;
+	uint32_t *old_tex_coord_index = tex_coord_index;
+	uint8_t *old_flags = flags;
+	uint8_t *old_lod_band = lod_band;
+
+	_assign_arrays(new_block, p_capacity);
+
+	if (block) {
+		copymem(position_x, old_position_x, sizeof(float) * count);
+		copymem(position_y, old_position_y, sizeof(float) * count);
+		copymem(position_z, old_position_z, sizeof(float) * count);
+		copymem(velocity, old_velocity, sizeof(float) * count);
+		copymem(inv_mass, old_inv_mass, sizeof(float) * count);
+		copymem(hit_height, old_hit_height, sizeof(float) * count);
+		copymem(tex_coord_index, old_tex_coord_index, sizeof(uint32_t) * count);
+		copymem(flags, old_flags, sizeof(uint8_t) * count);
+		copymem(lod_band, old_lod_band, sizeof(uint8_t) * count);
+		memfree(block);
+	}
+
+	block = new_block;
+	capacity = p_capacity;
+}
+
+uint32_t PrecipitationParticlePool::spawn(uint32_t p_count) {
+	uint32_t first = count;
+	if (count + p_count > capacity) {
+		// Grow geometrically so repeated small spawns stay amortised O(1).
+		reserve(MAX(count + p_count, capacity * 2));
+	}
+	count += p_count;
+	return first;
+}
+
+void PrecipitationParticlePool::kill(uint32_t p_index) {
+	ERR_FAIL_INDEX(p_index, count);
+
+	uint32_t last = count - 1;
+	if (p_index != last) {
+		position_x[p_index] = position_x[last];
+		position_y[p_index] = position_y[last];
+		position_z[p_index] = position_z[last];
+		velocity[p_index] = velocity[last];
+		inv_mass[p_index] = inv_mass[last];
+		hit_height[p_index] = hit_height[last];
+		tex_coord_index[p_index] = tex_coord_index[last];
+		flags[p_index] = flags[last];
+		lod_band[p_index] = lod_band[last];
+	}
+	count = last;
+}
+
+void PrecipitationParticlePool::resize(uint32_t p_count) {
+	if (p_count > capacity)
+		reserve(p_count);
+	count = p_count;
+}
+
+void PrecipitationParticlePool::clear() {
+	if (block)
+		memfree(block);
+
+	block = NULL;
+	count = 0;
+	capacity = 0;
+
+	position_x = NULL;
+	position_y = NULL;
+	position_z = NULL;
+	velocity = NULL;
+	inv_mass = NULL;
+	hit_height = NULL;
+	tex_coord_index = NULL;
+	flags = NULL;
+	lod_band = NULL;
+}
+
+void PrecipitationParticlePool::set_view(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to) {
+	clear();
+
+	position_x = p_pool.position_x + p_from;
+	position_y = p_pool.position_y + p_from;
+	position_z = p_pool.position_z + p_from;
+	velocity = p_pool.velocity + p_from;
+	inv_mass = p_pool.inv_mass + p_from;
+	hit_height = p_pool.hit_height + p_from;
+	tex_coord_index = p_pool.tex_coord_index + p_from;
+	flags = p_pool.flags + p_from;
+	lod_band = p_pool.lod_band + p_from;
+
+	count = p_to - p_from;
+	capacity = count;
+}
+
+PrecipitationParticlePool::PrecipitationParticlePool() {
+	block = NULL;
+	clear();
+}
+
+PrecipitationParticlePool::~PrecipitationParticlePool() {
+	clear();
+}
@@ -0,0 +1,66 @@
+#ifndef PRECIPITATION_PARTICLE_POOL_H
+#define PRECIPITATION_PARTICLE_POOL_H
+
+#include "typedefs.h"
+
+// Structure-of-arrays particle storage. Every attribute lives in its own contiguous array inside one
+// allocation, so the simulation and mesh passes walk memory linearly and spawning/killing a particle
+// is an index operation rather than a heap allocation.
+
+class PrecipitationParticlePool {
+public:
+	enum {
+		FLAG_VALID = 1 << 0,
+		FLAG_RENDER = 1 << 1,
+		FLAG_RESPAWN = 1 << 2,
+		FLAG_PENDING_CUTOFF = 1 << 3,
+	};
+
+	// Arrays are aligned to this many bytes and capacity is rounded up to a multiple of
+	// (ALIGNMENT / sizeof(float)) so vector loads never straddle the end of an array.
+	enum {
+		ALIGNMENT = 32,
+		CAPACITY_GRANULARITY = ALIGNMENT / sizeof(float)
+	};
+
+	float *position_x;
+	float *position_y;
+	float *position_z;
+	float *velocity;
+	float *inv_mass;
+	float *hit_height;
+	uint32_t *tex_coord_index;
+	uint8_t *flags;
+	uint8_t *lod_band;
+
+private:
+	uint8_t *block;
+	uint32_t count;
+	uint32_t capacity;
+
+	void _assign_arrays(uint8_t *p_block, uint32_t p_capacity);
+
+public:
+	void reserve(uint32_t p_capacity);
+	uint32_t spawn(uint32_t p_count);
+	void kill(uint32_t p_index);
+	void resize(uint32_t p_count);
+	void clear();
+
+	// Makes this pool a non-owning view of [p_from, p_to) of p_pool, indexed from zero, for handing part of
+	// a pool to code that works on whole pools. The view must not outlive or grow past p_pool's storage.
+	void set_view(const PrecipitationParticlePool &p_pool, uint32_t p_from, uint32_t p_to);
+
+	_FORCE_INLINE_ uint32_t size() const {
+		return count;
+	}
+
+	_FORCE_INLINE_ uint32_t get_capacity() const {
+		return capacity;
+	}
+
+	PrecipitationParticlePool();
+	~PrecipitationParticlePool();
+};
+
+#endif // PRECIPITATION_PARTICLE_POOL_H
@@ -0,0 +1,95 @@
+#include "precipitation_procedural.h"
+#include "dvector.h"
+#include "math_funcs.h"
+#include "servers/visual_server.h"
+
+Array PrecipitationProcedural::make_mesh_arrays(uint32_t p_drop_count, const Vector3 &p_box_size, float p_min_speed, float p_max_speed, float p_min_mass, float p_max_mass, int p_drops_per_texture, const Vector<Vector2> &p_coordinates, uint32_t p_seed) {
+	PrecipitationRandom random;
+	random.set_seed(p_seed);
+
+	DVector<Vector3> vertices;
+	DVector<Vector2> uvs;
+	DVector<Vector2> uv2s;
+	DVector<Color> colors;
+	DVector<int> indices;
+
+	vertices.resize(p_drop_count * 4);
+	uvs.resize(p_drop_count * 4);
+	uv2s.resize(p_drop_count * 4);
+	colors.resize(p_drop_count * 4);
+	indices.resize(p_drop_count * 6);
+
+	{
+		DVector<Vector3>::Write vertex = vertices.write();
+		DVector<Vector2>::Write uv = uvs.write();
+		DVector<Vector2>::Write uv2 = uv2s.write();
+		DVector<Color>::Write color = colors.write();
+		DVector<int>::Write index = indices.write();
+
+		int tex_coord_count = MAX(p_drops_per_texture * p_drops_per_texture, 1);
+		const Color corners[4] = { Color(0, 1, 0), Color(1, 1, 0), Color(0, 0, 0), Color(1, 0, 0) };
+
+		for (uint32_t i = 0; i < p_drop_count; i++) {
+			Vector3 offset = Vector3(random.randf() * p_box_size.x, random.randf() * p_box_size.y, random.randf() * p_box_size.z);
+			float speed = random.randf() * (p_max_speed - p_min_speed) + p_min_speed;
+			float inv_mass = 1.0 / (random.randf() * (p_max_mass - p_min_mass) + p_min_mass);
+			int tex_coord_index = MIN((int)(random.randf() * tex_coord_count), tex_coord_count - 1);
+
+			for (int j = 0; j < 4; j++) {
+				int v = i * 4 + j;
+				vertex[v] = offset;
+				uv[v] = p_coordinates.size() ? p_coordinates[tex_coord_index * 4 + j] : Vector2();
+				uv2[v] = Vector2(speed, inv_mass);
+				color[v] = corners[j];
+			}
+
+			int base = i * 4;
+			index[i * 6 + 0] = base;
+			index[i * 6 + 1] = base + 1;
+			index[i * 6 + 2] = base + 3;
+			index[i * 6 + 3] = base + 3;
+			index[i * 6 + 4] = base + 2;
+			index[i * 6 + 5] = base;
+		}
+	}
+
+	Array arrays;
+	arrays.resize(VS::ARRAY_MAX);
+	arrays[VS::ARRAY_VERTEX] = vertices;
+	arrays[VS::ARRAY_TEX_UV] = uvs;
+	arrays[VS::ARRAY_TEX_UV2] = uv2s;
+	arrays[VS::ARRAY_COLOR] = colors;
+	arrays[VS::ARRAY_INDEX] = indices;
+	return arrays;
+}
+
+Vector3 PrecipitationProcedural::get_drop_position(const Vector3 &p_offset, float p_speed, float p_inv_mass, const Vector3 &p_wind_velocity, const Vector3 &p_box_min, const Vector3 &p_box_size, float p_steps) {
+	Vector3 velocity = p_wind_velocity * p_inv_mass - Vector3(0, p_speed, 0);
+	Vector3 local = p_offset + velocity * p_steps - p_box_min;
+
+	local.x -= Math::floor(local.x / p_box_size.x) * p_box_size.x;
+	local.y -= Math::floor(local.y / p_box_size.y) * p_box_size.y;
+	local.z -= Math::floor(local.z / p_box_size.z) * p_box_size.z;
+
+	return p_box_min + local;
+}
+
+String PrecipitationProcedural::get_vertex_shader_code() {
+	return String() +
+		   "uniform float PrecipitationSteps;\n"
+		   "uniform vec3 WindVelocity;\n"
+		   "uniform vec3 BoxMin;\n"
+		   "uniform vec3 BoxSize;\n"
+		   "uniform float DropSize;\n"
+		   "uniform vec3 CameraPosition;\n"
+		   "\n"
+		   "vec3 velocity = WindVelocity * UV2.y - vec3(0.0, UV2.x, 0.0);\n"
+		   "vec3 local = SRC_VERTEX + velocity * PrecipitationSteps - BoxMin;\n"
+		   "local = local - floor(local / BoxSize) * BoxSize;\n"
+		   "vec3 center = BoxMin + local;\n"
+		   // Drops that neither fall nor drift, with no minimum speed and no wind, are drawn upright.
+		   "vec3 fall = normalize(mix(vec3(0.0, -1.0, 0.0), velocity, step(0.000001, dot(velocity, velocity))));\n"
+		   "vec3 side = normalize(cross(fall, CameraPosition - center));\n"
+		   "vec3 world = center + (side * (COLOR.r * 2.0 - 1.0) + fall * (COLOR.g * 2.0 - 1.0)) * DropSize;\n"
+		   "VERTEX = (INV_CAMERA_MATRIX * vec4(world, 1.0)).xyz;\n";
+}
@@ -0,0 +1,39 @@
+#ifndef PRECIPITATION_PROCEDURAL_H
+#define PRECIPITATION_PROCEDURAL_H
+
+#include "array.h"
+#include "math_2d.h"
+#include "vector3.h"
+#include "vector.h"
+#include "precipitation_random.h"
+
+// Stateless precipitation: a static mesh where every drop carries its spawn offset, speed and inverse mass
+// as vertex attributes, and the vertex shader moves it with the same wrap-in-box maths the simulation
+// uses. The per-frame CPU cost is a handful of shader uniforms.
+//
+// Vertex layout, four vertices per drop:
+//   VERTEX  spawn offset inside the box, in [0, box size)
+//   UV      texture atlas coordinate of the corner
+//   UV2     (speed, inverse mass)
+//   COLOR   rg: quad corner in [0, 1]
+
+class PrecipitationProcedural {
+public:
+	enum {
+		// The elapsed steps handed to the shader wrap at this, about four and a half minutes at the reference
+		// rate, so velocity times steps stays small enough for single precision to move the drops smoothly.
+		// The drops have no common period, so they are reshuffled once each time it wraps.
+		STEP_PERIOD = 16384
+	};
+
+	static Array make_mesh_arrays(uint32_t p_drop_count, const Vector3 &p_box_size, float p_min_speed, float p_max_speed, float p_min_mass, float p_max_mass, int p_drops_per_texture, const Vector<Vector2> &p_coordinates, uint32_t p_seed);
+
+	// Reference for what the shader computes for a drop's centre. p_box_min is the minimum corner of the
+	// box that follows the camera and p_steps is the elapsed time in simulation steps, the unit speeds and
+	// wind are expressed in.
+	static Vector3 get_drop_position(const Vector3 &p_offset, float p_speed, float p_inv_mass, const Vector3 &p_wind_velocity, const Vector3 &p_box_min, const Vector3 &p_box_size, float p_steps);
+
+	static String get_vertex_shader_code();
+};
+
+#endif // PRECIPITATION_PROCEDURAL_H
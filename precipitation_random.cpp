@@ -0,0 +1,47 @@
+#include "precipitation_random.h"
+
+void PrecipitationRandom::set_seed(uint32_t p_seed) {
+	seed = p_seed;
+	// Spread nearby seeds apart so seed 1 is not seed 0 shifted by one value.
+	key = _hash(p_seed ^ 0x9e3779b9);
+	counter = 0;
+}
+
+void PrecipitationRandom::fill(float *r_values, uint32_t p_count, float p_min, float p_max) {
+	const uint32_t base = key + counter;
+	const float scale = (p_max - p_min) * (1.0f / 16777216.0f);
+
+	for (uint32_t i = 0; i < p_count; i++) {
+		r_values[i] = p_min + (int)(_hash(base + i) >> 8) * scale;
+	}
+
+	counter += p_count;
+}
+
+void PrecipitationRandom::fill_reciprocal(float *r_values, uint32_t p_count, float p_min, float p_max) {
+	const uint32_t base = key + counter;
+	const float scale = (p_max - p_min) * (1.0f / 16777216.0f);
+
+	for (uint32_t i = 0; i < p_count; i++) {
+		r_values[i] = 1.0f / (p_min + (int)(_hash(base + i) >> 8) * scale);
+	}
+
+	counter += p_count;
+}
+
+void PrecipitationRandom::fill_index(uint32_t *r_values, uint32_t p_count, uint32_t p_range) {
+	const uint32_t base = key + counter;
+	const float scale = p_range * (1.0f / 16777216.0f);
+	const int last = (int)MAX(p_range, 1u) - 1;
+
+	for (uint32_t i = 0; i < p_count; i++) {
+		int index = (int)((int)(_hash(base + i) >> 8) * scale);
+		r_values[i] = index < last ? index : last;
+	}
+
+	counter += p_count;
+}
+
+PrecipitationRandom::PrecipitationRandom() {
+	set_seed(0);
+}
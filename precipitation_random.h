@@ -0,0 +1,58 @@
+#ifndef PRECIPITATION_RANDOM_H
+#define PRECIPITATION_RANDOM_H
+
+#include "typedefs.h"
+
+// Counter-based generator: value n of a stream is a hash of the seed and n, with no state carried from one
+// value to the next. The same seed always produces the same sequence, independent of the global generator
+// and of threads, and the batch fills are plain loops the compiler can vectorise.
+class PrecipitationRandom {
+	uint32_t seed;
+	uint32_t key;
+	uint32_t counter;
+
+	static _FORCE_INLINE_ uint32_t _hash(uint32_t p_value) {
+		p_value ^= p_value >> 16;
+		p_value *= 0x7feb352d;
+		p_value ^= p_value >> 15;
+		p_value *= 0x846ca68b;
+		p_value ^= p_value >> 16;
+		return p_value;
+	}
+
+public:
+	void set_seed(uint32_t p_seed);
+
+	_FORCE_INLINE_ uint32_t get_seed() const {
+		return seed;
+	}
+
+	// Position in the stream; seeking lets a batch be generated in pieces with the same values.
+	_FORCE_INLINE_ uint32_t get_counter() const {
+		return counter;
+	}
+
+	_FORCE_INLINE_ void seek(uint32_t p_counter) {
+		counter = p_counter;
+	}
+
+	_FORCE_INLINE_ uint32_t next() {
+		return _hash(key + counter++);
+	}
+
+	// In [0, 1), from the top 24 bits so every value is exact in a float.
+	_FORCE_INLINE_ float randf() {
+		return (int)(next() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Fills r_values[0, p_count) with values in [p_min, p_max).
+	void fill(float *r_values, uint32_t p_count, float p_min, float p_max);
+	// Fills r_values[0, p_count) with 1 / x, x in [p_min, p_max).
+	void fill_reciprocal(float *r_values, uint32_t p_count, float p_min, float p_max);
+	// Fills r_values[0, p_count) with integers in [0, p_range).
+	void fill_index(uint32_t *r_values, uint32_t p_count, uint32_t p_range);
+
+	PrecipitationRandom();
+};
+
+#endif // PRECIPITATION_RANDOM_H
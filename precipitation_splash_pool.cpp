@@ -0,0 +1,62 @@
+#include "precipitation_splash_pool.h"
+#include "os/memory.h"
+
+void PrecipitationSplashPool::set_capacity(uint32_t p_capacity) {
+	if (p_capacity == capacity)
+		return;
+
+	if (block)
+		memfree(block);
+
+	block = p_capacity ? (float *)memalloc(sizeof(float) * 4 * p_capacity) : NULL;
+	capacity = block ? p_capacity : 0;
+
+	position_x = block;
+	position_y = block + capacity;
+	position_z = block + capacity * 2;
+	age = block + capacity * 3;
+
+	used = 0;
+	head = 0;
+}
+
+void PrecipitationSplashPool::spawn(float p_x, float p_y, float p_z) {
+	if (capacity == 0)
+		return;
+
+	position_x[head] = p_x;
+	position_y[head] = p_y;
+	position_z[head] = p_z;
+	age[head] = 0;
+
+	head = head + 1 < capacity ? head + 1 : 0;
+	used = MAX(used, head == 0 ? capacity : head);
+}
+
+void PrecipitationSplashPool::advance(float p_time) {
+	for (uint32_t i = 0; i < used; i++) {
+		age[i] += p_time;
+	}
+}
+
+void PrecipitationSplashPool::clear() {
+	used = 0;
+	head = 0;
+}
+
+PrecipitationSplashPool::PrecipitationSplashPool() {
+	position_x = NULL;
+	position_y = NULL;
+	position_z = NULL;
+	age = NULL;
+
+	block = NULL;
+	capacity = 0;
+	used = 0;
+	head = 0;
+}
+
+PrecipitationSplashPool::~PrecipitationSplashPool() {
+	if (block)
+		memfree(block);
+}
@@ -0,0 +1,43 @@
+#ifndef PRECIPITATION_SPLASH_POOL_H
+#define PRECIPITATION_SPLASH_POOL_H
+
+#include "typedefs.h"
+
+// Fixed-size ring of short-lived impact splashes. Every splash lives for the same time and they are spawned
+// in time order, so the slot after the newest always holds the oldest and spawning simply overwrites it.
+// Storage is allocated when the capacity changes and never while splashes are spawned.
+
+class PrecipitationSplashPool {
+public:
+	float *position_x;
+	float *position_y;
+	float *position_z;
+	// Seconds since the splash spawned.
+	float *age;
+
+private:
+	float *block;
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t head;
+
+public:
+	void set_capacity(uint32_t p_capacity);
+	void spawn(float p_x, float p_y, float p_z);
+	void advance(float p_time);
+	void clear();
+
+	// Slots that have held a splash; expired ones among them are skipped by age.
+	_FORCE_INLINE_ uint32_t size() const {
+		return used;
+	}
+
+	_FORCE_INLINE_ uint32_t get_capacity() const {
+		return capacity;
+	}
+
+	PrecipitationSplashPool();
+	~PrecipitationSplashPool();
+};
+
+#endif // PRECIPITATION_SPLASH_POOL_H
@@ -0,0 +1,170 @@
+#include "precipitation_wind_field.h"
+
+static _FORCE_INLINE_ float _trilinear(const float *p_values, int p_base, int p_stride_y, int p_stride_z, float p_tx, float p_ty, float p_tz) {
+	const float *v0 = p_values + p_base;
+	const float *v1 = v0 + p_stride_z;
+
+	float a = v0[0] + (v0[1] - v0[0]) * p_tx;
+	float b = v0[p_stride_y] + (v0[p_stride_y + 1] - v0[p_stride_y]) * p_tx;
+	float c = v1[0] + (v1[1] - v1[0]) * p_tx;
+	float d = v1[p_stride_y] + (v1[p_stride_y + 1] - v1[p_stride_y]) * p_tx;
+
+	float front = a + (b - a) * p_ty;
+	float back = c + (d - c) * p_ty;
+	return front + (back - front) * p_tz;
+}
+
+void PrecipitationWindField::_update_max_speed() {
+	max_speed = 0;
+	for (int i = 0; i < velocity_x.size(); i++) {
+		max_speed = MAX(max_speed, Vector3(velocity_x[i], velocity_y[i], velocity_z[i]).length());
+	}
+}
+
+void PrecipitationWindField::set_bounds(const AABB &p_bounds) {
+	bounds = p_bounds;
+	emit_changed();
+}
+
+void PrecipitationWindField::set_resolution(const Vector3 &p_resolution) {
+	resolution_x = CLAMP((int)p_resolution.x, 2, 256);
+	resolution_y = CLAMP((int)p_resolution.y, 2, 256);
+	resolution_z = CLAMP((int)p_resolution.z, 2, 256);
+
+	int count = resolution_x * resolution_y * resolution_z;
+	velocity_x.resize(count);
+	velocity_y.resize(count);
+	velocity_z.resize(count);
+	for (int i = 0; i < count; i++) {
+		velocity_x[i] = 0;
+		velocity_y[i] = 0;
+		velocity_z[i] = 0;
+	}
+
+	max_speed = 0;
+	emit_changed();
+}
+
+void PrecipitationWindField::set_velocities(const DVector<Vector3> &p_velocities) {
+	ERR_FAIL_COND(p_velocities.size() != velocity_x.size());
+
+	DVector<Vector3>::Read r = p_velocities.read();
+	for (int i = 0; i < velocity_x.size(); i++) {
+		velocity_x[i] = r[i].x;
+		velocity_y[i] = r[i].y;
+		velocity_z[i] = r[i].z;
+	}
+
+	_update_max_speed();
+	emit_changed();
+}
+
+DVector<Vector3> PrecipitationWindField::get_velocities() const {
+	DVector<Vector3> velocities;
+	velocities.resize(velocity_x.size());
+
+	DVector<Vector3>::Write w = velocities.write();
+	for (int i = 0; i < velocity_x.size(); i++) {
+		w[i] = Vector3(velocity_x[i], velocity_y[i], velocity_z[i]);
+	}
+
+	return velocities;
+}
+
+void PrecipitationWindField::set_velocity(int p_x, int p_y, int p_z, const Vector3 &p_velocity) {
+	ERR_FAIL_INDEX(p_x, resolution_x);
+	ERR_FAIL_INDEX(p_y, resolution_y);
+	ERR_FAIL_INDEX(p_z, resolution_z);
+
+	int index = (p_z * resolution_y + p_y) * resolution_x + p_x;
+	float old_speed = Vector3(velocity_x[index], velocity_y[index], velocity_z[index]).length();
+	velocity_x[index] = p_velocity.x;
+	velocity_y[index] = p_velocity.y;
+	velocity_z[index] = p_velocity.z;
+
+	// Filling the field cell by cell stays linear: the whole field is only rescanned when the fastest cell slows.
+	float speed = p_velocity.length();
+	if (speed >= max_speed)
+		max_speed = speed;
+	else if (old_speed >= max_speed)
+		_update_max_speed();
+	emit_changed();
+}
+
+Vector3 PrecipitationWindField::get_velocity(int p_x, int p_y, int p_z) const {
+	ERR_FAIL_INDEX_V(p_x, resolution_x, Vector3());
+	ERR_FAIL_INDEX_V(p_y, resolution_y, Vector3());
+	ERR_FAIL_INDEX_V(p_z, resolution_z, Vector3());
+
+	int index = (p_z * resolution_y + p_y) * resolution_x + p_x;
+	return Vector3(velocity_x[index], velocity_y[index], velocity_z[index]);
+}
+
+Vector3 PrecipitationWindField::sample(const Vector3 &p_position) const {
+	Vector3 velocity;
+	sample_batch(&p_position.x, &p_position.y, &p_position.z, 1, &velocity.x, &velocity.y, &velocity.z);
+	return velocity;
+}
+
+void PrecipitationWindField::sample_batch(const float *p_x, const float *p_y, const float *p_z, uint32_t p_count, float *r_x, float *r_y, float *r_z) const {
+	const float *vx = velocity_x.ptr();
+	const float *vy = velocity_y.ptr();
+	const float *vz = velocity_z.ptr();
+
+	const float origin_x = bounds.pos.x;
+	const float origin_y = bounds.pos.y;
+	const float origin_z = bounds.pos.z;
+	const float scale_x = (resolution_x - 1) / MAX(bounds.size.x, CMP_EPSILON);
+	const float scale_y = (resolution_y - 1) / MAX(bounds.size.y, CMP_EPSILON);
+	const float scale_z = (resolution_z - 1) / MAX(bounds.size.z, CMP_EPSILON);
+	const float last_x = resolution_x - 1;
+	const float last_y = resolution_y - 1;
+	const float last_z = resolution_z - 1;
+	const int stride_y = resolution_x;
+	const int stride_z = resolution_x * resolution_y;
+
+	for (uint32_t i = 0; i < p_count; i++) {
+		float fx = CLAMP((p_x[i] - origin_x) * scale_x, 0.0f, last_x);
+		float fy = CLAMP((p_y[i] - origin_y) * scale_y, 0.0f, last_y);
+		float fz = CLAMP((p_z[i] - origin_z) * scale_z, 0.0f, last_z);
+
+		// The last cell starts one sample before the edge, so the far corners are always in range.
+		int ix = MIN((int)fx, resolution_x - 2);
+		int iy = MIN((int)fy, resolution_y - 2);
+		int iz = MIN((int)fz, resolution_z - 2);
+
+		float tx = fx - ix;
+		float ty = fy - iy;
+		float tz = fz - iz;
+		int base = iz * stride_z + iy * stride_y + ix;
+
+		r_x[i] = _trilinear(vx, base, stride_y, stride_z, tx, ty, tz);
+		r_y[i] = _trilinear(vy, base, stride_y, stride_z, tx, ty, tz);
+		r_z[i] = _trilinear(vz, base, stride_y, stride_z, tx, ty, tz);
+	}
+}
+
+void PrecipitationWindField::_bind_methods() {
+	ObjectTypeDB::bind_method(_MD("set_bounds", "bounds"), &PrecipitationWindField::set_bounds);
+	ObjectTypeDB::bind_method(_MD("get_bounds"), &PrecipitationWindField::get_bounds);
+	ObjectTypeDB::bind_method(_MD("set_resolution", "resolution"), &PrecipitationWindField::set_resolution);
+	ObjectTypeDB::bind_method(_MD("get_resolution"), &PrecipitationWindField::get_resolution);
+	ObjectTypeDB::bind_method(_MD("set_velocities", "velocities"), &PrecipitationWindField::set_velocities);
+	ObjectTypeDB::bind_method(_MD("get_velocities"), &PrecipitationWindField::get_velocities);
+
+	ObjectTypeDB::bind_method(_MD("set_velocity", "x", "y", "z", "velocity"), &PrecipitationWindField::set_velocity);
+	ObjectTypeDB::bind_method(_MD("get_velocity", "x", "y", "z"), &PrecipitationWindField::get_velocity);
+	ObjectTypeDB::bind_method(_MD("get_max_speed"), &PrecipitationWindField::get_max_speed);
+	ObjectTypeDB::bind_method(_MD("sample", "position"), &PrecipitationWindField::sample);
+
+	// Resolution comes before the velocities so a loaded field is sized before it is filled.
+	ADD_PROPERTY(PropertyInfo(Variant::_AABB, "bounds", PROPERTY_HINT_NONE), _SCS("set_bounds"), _SCS("get_bounds"));
+	ADD_PROPERTY(PropertyInfo(Variant::VECTOR3, "resolution", PROPERTY_HINT_NONE), _SCS("set_resolution"), _SCS("get_resolution"));
+	ADD_PROPERTY(PropertyInfo(Variant::VECTOR3_ARRAY, "velocities", PROPERTY_HINT_NONE), _SCS("set_velocities"), _SCS("get_velocities"));
+}
+
+PrecipitationWindField::PrecipitationWindField() {
+	bounds = AABB(Vector3(-10, -10, -10), Vector3(20, 20, 20));
+	max_speed = 0;
+	set_resolution(Vector3(2, 2, 2));
+}
@@ -0,0 +1,63 @@
+#ifndef PRECIPITATION_WIND_FIELD_H
+#define PRECIPITATION_WIND_FIELD_H
+
+#include "resource.h"
+
+// Low resolution grid of wind velocities over a world-space region, sampled with trilinear interpolation.
+// Samples are laid out x fastest, then y, then z, and points outside the region take the nearest edge value.
+// Velocities are in the same units as Precipitation's wind_velocity, which they are added to.
+
+class PrecipitationWindField : public Resource {
+
+	OBJ_TYPE(PrecipitationWindField, Resource);
+	RES_BASE_EXTENSION("wfield");
+
+	AABB bounds;
+	int resolution_x;
+	int resolution_y;
+	int resolution_z;
+
+	// One array per component so sample() can run as a plain loop.
+	Vector<float> velocity_x;
+	Vector<float> velocity_y;
+	Vector<float> velocity_z;
+	float max_speed;
+
+	void _update_max_speed();
+
+protected:
+	static void _bind_methods();
+
+public:
+	void set_bounds(const AABB &p_bounds);
+
+	_FORCE_INLINE_ AABB get_bounds() const {
+		return bounds;
+	}
+
+	// Every axis has at least two samples. Changing the resolution clears the field.
+	void set_resolution(const Vector3 &p_resolution);
+
+	_FORCE_INLINE_ Vector3 get_resolution() const {
+		return Vector3(resolution_x, resolution_y, resolution_z);
+	}
+
+	void set_velocities(const DVector<Vector3> &p_velocities);
+	DVector<Vector3> get_velocities() const;
+
+	void set_velocity(int p_x, int p_y, int p_z, const Vector3 &p_velocity);
+	Vector3 get_velocity(int p_x, int p_y, int p_z) const;
+
+	// Largest velocity in the field, an upper bound on any sample.
+	_FORCE_INLINE_ float get_max_speed() const {
+		return max_speed;
+	}
+
+	Vector3 sample(const Vector3 &p_position) const;
+	// Samples p_count points given as separate coordinate arrays into separate component arrays.
+	void sample_batch(const float *p_x, const float *p_y, const float *p_z, uint32_t p_count, float *r_x, float *r_y, float *r_z) const;
+
+	PrecipitationWindField();
+};
+
+#endif // PRECIPITATION_WIND_FIELD_H
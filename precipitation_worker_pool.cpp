@@ -0,0 +1,91 @@
+#include "precipitation_worker_pool.h"
+#include "safe_refcount.h"
+
+void PrecipitationWorkerPool::_run_jobs(uint32_t p_thread) {
+	while (true) {
+		uint32_t job = atomic_increment(&next_job) - 1;
+		if (job >= job_count)
+			break;
+		callback(userdata, job, p_thread);
+	}
+}
+
+void PrecipitationWorkerPool::_worker_thread(void *p_worker) {
+	Worker *worker = (Worker *)p_worker;
+	PrecipitationWorkerPool *pool = worker->pool;
+
+	while (true) {
+		worker->start->wait();
+		if (pool->exit)
+			break;
+
+		pool->_run_jobs(worker->index);
+		pool->finished->post();
+	}
+}
+
+void PrecipitationWorkerPool::set_thread_count(int p_count) {
+	int worker_count = MAX(p_count - 1, 0);
+	if (worker_count == workers.size())
+		return;
+
+	exit = true;
+	for (int i = 0; i < workers.size(); i++) {
+		workers[i]->start->post();
+	}
+	for (int i = 0; i < workers.size(); i++) {
+		Thread::wait_to_finish(workers[i]->thread);
+		memdelete(workers[i]->thread);
+		memdelete(workers[i]->start);
+		memdelete(workers[i]);
+	}
+	workers.clear();
+	exit = false;
+
+	for (int i = 0; i < worker_count; i++) {
+		Worker *worker = memnew(Worker);
+		worker->pool = this;
+		worker->index = i + 1;
+		worker->start = Semaphore::create();
+		worker->thread = Thread::create(_worker_thread, worker);
+		workers.push_back(worker);
+	}
+}
+
+void PrecipitationWorkerPool::run(JobCallback p_callback, void *p_userdata, uint32_t p_job_count) {
+	callback = p_callback;
+	userdata = p_userdata;
+	job_count = p_job_count;
+	next_job = 0;
+
+	if (workers.empty() || p_job_count <= 1) {
+		_run_jobs(0);
+		return;
+	}
+
+	int woken = MIN(workers.size(), (int)p_job_count - 1);
+	for (int i = 0; i < woken; i++) {
+		workers[i]->start->post();
+	}
+
+	_run_jobs(0);
+
+	for (int i = 0; i < woken; i++) {
+		finished->wait();
+	}
+}
+
+PrecipitationWorkerPool::PrecipitationWorkerPool() {
+	finished = Semaphore::create();
+	exit = false;
+
+	callback = NULL;
+	userdata = NULL;
+	job_count = 0;
+	next_job = 0;
+}
+
+PrecipitationWorkerPool::~PrecipitationWorkerPool() {
+	set_thread_count(1);
+	memdelete(finished);
+}
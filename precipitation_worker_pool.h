@@ -0,0 +1,51 @@
+#ifndef PRECIPITATION_WORKER_POOL_H
+#define PRECIPITATION_WORKER_POOL_H
+
+#include "os/semaphore.h"
+#include "os/thread.h"
+#include "vector.h"
+
+// Small fork/join pool. run() hands out job indices from a shared atomic counter, so idle threads keep
+// taking work until none is left, and the calling thread works alongside the pool. Jobs must only write
+// to state owned by their own index if the result is to be independent of the thread count. Each job is
+// also told which thread runs it, from zero (the calling thread) to get_thread_count() - 1, for scratch
+// space that only needs to be private to a thread.
+
+class PrecipitationWorkerPool {
+public:
+	typedef void (*JobCallback)(void *p_userdata, uint32_t p_job, uint32_t p_thread);
+
+private:
+	struct Worker {
+		Thread *thread;
+		Semaphore *start;
+		PrecipitationWorkerPool *pool;
+		uint32_t index;
+	};
+
+	Vector<Worker *> workers;
+	Semaphore *finished;
+	bool exit;
+
+	JobCallback callback;
+	void *userdata;
+	uint32_t job_count;
+	uint32_t next_job;
+
+	void _run_jobs(uint32_t p_thread);
+	static void _worker_thread(void *p_worker);
+
+public:
+	void set_thread_count(int p_count);
+
+	_FORCE_INLINE_ int get_thread_count() const {
+		return workers.size() + 1;
+	}
+
+	void run(JobCallback p_callback, void *p_userdata, uint32_t p_job_count);
+
+	PrecipitationWorkerPool();
+	~PrecipitationWorkerPool();
+};
+
+#endif // PRECIPITATION_WORKER_POOL_H
@@ -1,14 +1,44 @@
 #include "register_types.h"
 #ifndef _3D_DISABLED
 #include "object_type_db.h"
+#include "globals.h"
 #endif
 #include "precipitation.h"
+#include "precipitation_batcher.h"
+#include "precipitation_benchmark.h"
+#include "precipitation_occlusion_map.h"
+#include "precipitation_wind_field.h"
+
+#ifndef _3D_DISABLED
+static PrecipitationBatcher *precipitation_batcher = NULL;
+static ResourceFormatLoaderPrecipitationOcclusionMap *occlusion_map_loader = NULL;
+static ResourceFormatSaverPrecipitationOcclusionMap *occlusion_map_saver = NULL;
+#endif
 
 void register_precipitation_types() {
 #ifndef _3D_DISABLED
 	ObjectTypeDB::register_type<Precipitation>();
+	ObjectTypeDB::register_type<PrecipitationBenchmark>();
+	ObjectTypeDB::register_type<PrecipitationWindField>();
+	ObjectTypeDB::register_type<PrecipitationOcclusionMap>();
+
+	occlusion_map_loader = memnew(ResourceFormatLoaderPrecipitationOcclusionMap);
+	ResourceLoader::add_resource_format_loader(occlusion_map_loader);
+	occlusion_map_saver = memnew(ResourceFormatSaverPrecipitationOcclusionMap);
+	ResourceSaver::add_resource_format_saver(occlusion_map_saver);
+
+	ObjectTypeDB::register_virtual_type<PrecipitationBatcher>();
+	precipitation_batcher = memnew(PrecipitationBatcher);
+	Globals::get_singleton()->add_singleton(Globals::Singleton("PrecipitationBatcher", precipitation_batcher));
 #endif
 }
 void unregister_precipitation_types() {
-	return;
+#ifndef _3D_DISABLED
+	if (precipitation_batcher)
+		memdelete(precipitation_batcher);
+	if (occlusion_map_loader)
+		memdelete(occlusion_map_loader);
+	if (occlusion_map_saver)
+		memdelete(occlusion_map_saver);
+#endif
 }